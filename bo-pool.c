@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "bo-pool.h"
+
+struct bo_pool {
+	struct gbm_device *gbm;
+	int kms_fd;
+	uint64_t cap;
+
+	/* released buffers, most recently released first */
+	struct pool_bo *free_list;
+	int cached;
+	uint64_t cached_bytes;
+
+	uint64_t hits, misses, trimmed;
+};
+
+static void close_handle(int fd, uint32_t handle)
+{
+	struct drm_gem_close close_request = {
+		.handle = handle
+	};
+
+	ioctl(fd, DRM_IOCTL_GEM_CLOSE, &close_request);
+}
+
+struct pool_bo *pool_bo_create(struct gbm_device *gbm, int kms_fd,
+                               uint32_t width, uint32_t height,
+                               uint32_t format, uint64_t modifier,
+                               uint32_t flags)
+{
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	uint64_t modifiers[4] = { 0 };
+	struct pool_bo *pbo;
+	int ret;
+
+	pbo = calloc(1, sizeof(*pbo));
+	if (!pbo)
+		return NULL;
+
+	pbo->width = width;
+	pbo->height = height;
+	pbo->format = format;
+	pbo->modifier = modifier;
+	pbo->flags = flags;
+	pbo->dma_buf_fd = -1;
+
+	if (modifier == DRM_FORMAT_MOD_INVALID)
+		pbo->bo = gbm_bo_create(gbm, width, height, format, flags);
+	else
+		pbo->bo = gbm_bo_create_with_modifiers(gbm, width, height, format,
+		                                       &modifier, 1);
+	if (!pbo->bo) {
+		printf("Could not create bo : %s (%d)\n", strerror(errno), errno);
+		goto fail;
+	}
+
+	pbo->stride = gbm_bo_get_stride(pbo->bo);
+	pbo->dma_buf_fd = gbm_bo_get_fd(pbo->bo);
+	if (pbo->dma_buf_fd < 0) {
+		printf("Could not export bo : %s (%d)\n", strerror(errno), errno);
+		goto fail;
+	}
+
+	/* The dma-buf knows how much memory there really is behind it */
+	pbo->size = lseek(pbo->dma_buf_fd, 0, SEEK_END);
+	if (pbo->size == (uint64_t) -1)
+		pbo->size = (uint64_t) pbo->stride * height;
+
+	ret = drmPrimeFDToHandle(kms_fd, pbo->dma_buf_fd, &pbo->prime_handle);
+	if (ret) {
+		printf("Could not import buffer : %s (%d) - FD : %d\n",
+		       strerror(errno), errno, pbo->dma_buf_fd);
+		goto fail;
+	}
+
+	if (!(flags & GBM_BO_USE_SCANOUT))
+		return pbo;
+
+	/* Every plane lives in the same dma-buf */
+	for (int p = 0; p < gbm_bo_get_plane_count(pbo->bo) && p < 4; p++) {
+		handles[p] = pbo->prime_handle;
+		pitches[p] = gbm_bo_get_stride_for_plane(pbo->bo, p);
+		offsets[p] = gbm_bo_get_offset(pbo->bo, p);
+		modifiers[p] = gbm_bo_get_modifier(pbo->bo);
+	}
+
+	if (modifiers[0] != DRM_FORMAT_MOD_INVALID)
+		ret = drmModeAddFB2WithModifiers(kms_fd, width, height, format,
+		                                 handles, pitches, offsets,
+		                                 modifiers, &pbo->fb_id,
+		                                 DRM_MODE_FB_MODIFIERS);
+	else
+		ret = drmModeAddFB2(kms_fd, width, height, format,
+		                    handles, pitches, offsets, &pbo->fb_id, 0);
+	if (ret) {
+		printf("Could not add a framebuffer : %s\n", strerror(errno));
+		pbo->fb_id = 0;
+		goto fail;
+	}
+
+	return pbo;
+
+fail:
+	pool_bo_destroy(kms_fd, pbo);
+	return NULL;
+}
+
+void pool_bo_destroy(int kms_fd, struct pool_bo *pbo)
+{
+	if (pbo->fb_id)
+		drmModeRmFB(kms_fd, pbo->fb_id);
+	if (pbo->prime_handle)
+		close_handle(kms_fd, pbo->prime_handle);
+	if (pbo->dma_buf_fd >= 0)
+		close(pbo->dma_buf_fd);
+	if (pbo->bo)
+		gbm_bo_destroy(pbo->bo);
+	free(pbo);
+}
+
+struct bo_pool *bo_pool_create(struct gbm_device *gbm, int kms_fd,
+                               uint64_t cap)
+{
+	struct bo_pool *pool = calloc(1, sizeof(*pool));
+
+	if (!pool)
+		return NULL;
+
+	pool->gbm = gbm;
+	pool->kms_fd = kms_fd;
+	pool->cap = cap;
+
+	return pool;
+}
+
+struct pool_bo *bo_pool_get(struct bo_pool *pool,
+                            uint32_t width, uint32_t height,
+                            uint32_t format, uint64_t modifier,
+                            uint32_t flags)
+{
+	struct pool_bo **link;
+
+	for (link = &pool->free_list; *link; link = &(*link)->next) {
+		struct pool_bo *pbo = *link;
+
+		if (pbo->width != width || pbo->height != height ||
+		    pbo->format != format || pbo->modifier != modifier ||
+		    pbo->flags != flags)
+			continue;
+
+		*link = pbo->next;
+		pbo->next = NULL;
+		pool->cached--;
+		pool->cached_bytes -= pbo->size;
+		pool->hits++;
+
+		return pbo;
+	}
+
+	pool->misses++;
+
+	return pool_bo_create(pool->gbm, pool->kms_fd, width, height,
+	                      format, modifier, flags);
+}
+
+void bo_pool_put(struct bo_pool *pool, struct pool_bo *pbo)
+{
+	pbo->next = pool->free_list;
+	pool->free_list = pbo;
+	pool->cached++;
+	pool->cached_bytes += pbo->size;
+
+	bo_pool_trim(pool, pool->cap);
+}
+
+void bo_pool_trim(struct bo_pool *pool, uint64_t cap)
+{
+	/* The least recently released are at the end of the list */
+	while (pool->cached_bytes > cap && pool->free_list) {
+		struct pool_bo **link = &pool->free_list;
+
+		while ((*link)->next)
+			link = &(*link)->next;
+
+		pool->cached--;
+		pool->cached_bytes -= (*link)->size;
+		pool->trimmed++;
+		pool_bo_destroy(pool->kms_fd, *link);
+		*link = NULL;
+	}
+}
+
+void bo_pool_get_stats(struct bo_pool *pool, struct bo_pool_stats *stats)
+{
+	stats->hits = pool->hits;
+	stats->misses = pool->misses;
+	stats->trimmed = pool->trimmed;
+	stats->cached = pool->cached;
+	stats->cached_bytes = pool->cached_bytes;
+}
+
+void bo_pool_destroy(struct bo_pool *pool)
+{
+	bo_pool_trim(pool, 0);
+	free(pool);
+}
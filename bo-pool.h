@@ -0,0 +1,62 @@
+#ifndef BO_POOL_H
+#define BO_POOL_H
+
+#include <stdint.h>
+
+#include <gbm.h>
+
+/* A buffer ready to be rendered to and scanned out : the GBM bo, its
+ * exported dma-buf, its handle on the KMS device, and a framebuffer when
+ * it was asked for with GBM_BO_USE_SCANOUT. */
+struct pool_bo {
+	struct gbm_bo *bo;
+	int dma_buf_fd;
+	uint32_t prime_handle;
+	uint32_t fb_id;
+
+	/* what it was asked for with, the pool's key */
+	uint32_t width, height, format, flags;
+	uint64_t modifier;
+
+	uint32_t stride;
+	uint64_t size;
+
+	/* pool bookkeeping */
+	struct pool_bo *next;
+};
+
+/* Create and destroy one the long way, without any pool. Pass
+ * DRM_FORMAT_MOD_INVALID to let the driver pick the modifier. kms_fd must
+ * not be the fd the GBM device was created on, or the prime handle we close
+ * would be GBM's own. */
+struct pool_bo *pool_bo_create(struct gbm_device *gbm, int kms_fd,
+                               uint32_t width, uint32_t height,
+                               uint32_t format, uint64_t modifier,
+                               uint32_t flags);
+void pool_bo_destroy(int kms_fd, struct pool_bo *pbo);
+
+struct bo_pool_stats {
+	uint64_t hits, misses, trimmed;
+	uint64_t cached_bytes;
+	int cached;
+};
+
+/* Released buffers are kept to hand back out for the same width, height,
+ * format, modifier and flags, most recently released first. Once they
+ * take more than cap bytes, the least recently released go away.
+ * Not thread safe. */
+struct bo_pool;
+
+struct bo_pool *bo_pool_create(struct gbm_device *gbm, int kms_fd,
+                               uint64_t cap);
+struct pool_bo *bo_pool_get(struct bo_pool *pool,
+                            uint32_t width, uint32_t height,
+                            uint32_t format, uint64_t modifier,
+                            uint32_t flags);
+void bo_pool_put(struct bo_pool *pool, struct pool_bo *pbo);
+/* Drop cached buffers until they fit in cap bytes */
+void bo_pool_trim(struct bo_pool *pool, uint64_t cap);
+void bo_pool_get_stats(struct bo_pool *pool, struct bo_pool_stats *stats);
+void bo_pool_destroy(struct bo_pool *pool);
+
+#endif
@@ -0,0 +1,492 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#include <libdrm/drm.h>
+
+#include <gbm.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "latency.h"
+
+/* Allocators that are fine for an hour can crawl after days of buffers
+ * of every size coming and going. Do days' worth of that in minutes :
+ * random buffers, through both sharing paths the other tests use, created,
+ * passed to the other device and destroyed in random order, with a random
+ * number of them alive at any time.
+ *
+ * - gbm : the render node allocates, exports, and the display node imports
+ * - dumb : the display node allocates a dumb buffer, exports, and the
+ *   render node imports it with GBM
+ *
+ * Every interval, how long allocating took, what failed, and how much
+ * memory the process and both drivers are holding. A slowdown or growth
+ * that doesn't level off is what we're after.
+ */
+
+#define LOG(msg, ...) \
+	fprintf(\
+		stderr, "\n[%s (%s:%d)]\n"msg,\
+		__func__, __FILE__, __LINE__, ##__VA_ARGS__ \
+	)
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+enum bo_path {
+	BO_PATH_GBM,
+	BO_PATH_DUMB,
+};
+
+static char const * const bo_path_names[] = {
+	"gbm", "dumb"
+};
+
+static struct {
+	uint32_t format;
+	uint32_t bpp;
+} const stress_formats[] = {
+	{ GBM_FORMAT_XRGB8888, 32 },
+	{ GBM_FORMAT_ARGB8888, 32 },
+	{ GBM_FORMAT_RGB565, 16 },
+	{ GBM_FORMAT_R8, 8 },
+};
+
+/* What clients ask for most, the rest of the time anything goes */
+static uint32_t const stress_sizes[][2] = {
+	{ 64, 64 }, { 256, 256 }, { 1280, 720 }, { 1920, 1080 },
+	{ 2560, 1440 }, { 3840, 2160 },
+};
+
+struct stress_bo {
+	enum bo_path path;
+	struct gbm_bo *bo;
+	int dma_buf_fd;
+	/* on the display node */
+	uint32_t handle;
+};
+
+enum op {
+	OP_CREATE,
+	OP_EXPORT,
+	OP_IMPORT,
+	OP_DESTROY,
+	OP_COUNT
+};
+
+static char const * const op_names[] = {
+	"create", "export", "import", "destroy"
+};
+
+/* Latencies of one kind, growing as needed */
+struct samples {
+	uint64_t *ns;
+	size_t count, allocated;
+};
+
+#define MAX_DRM_KEYS 32
+
+/* The drm-* memory keys from a fdinfo file, in bytes */
+struct drm_memory {
+	char keys[MAX_DRM_KEYS][48];
+	uint64_t bytes[MAX_DRM_KEYS];
+	int count;
+};
+
+static void samples_add(struct samples * __restrict s, uint64_t ns)
+{
+	if (s->count == s->allocated) {
+		size_t const allocated = s->allocated ? s->allocated * 2 : 4096;
+		uint64_t *grown = realloc(s->ns, allocated * sizeof(*grown));
+
+		/* Dropping samples beats stopping the run */
+		if (!grown)
+			return;
+		s->ns = grown;
+		s->allocated = allocated;
+	}
+	s->ns[s->count++] = ns;
+}
+
+static void print_samples(char const * __restrict what,
+                          struct samples * __restrict s)
+{
+	if (!s->count) {
+		printf("  %-10s %6s\n", what, "-");
+		return;
+	}
+
+	printf("  ");
+	print_latencies(what, s->ns, (int) s->count);
+}
+
+/* Drivers account for what each open file holds in its fdinfo, with keys
+ * like drm-total-system0, drm-resident-vram or drm-memory-gtt. Not every
+ * driver has them : older kernels have none at all. */
+static void read_drm_memory(int fd, struct drm_memory * __restrict mem)
+{
+	char path[64], line[256];
+	FILE *f;
+
+	mem->count = 0;
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f) && mem->count < MAX_DRM_KEYS) {
+		char key[48], unit[8] = "";
+		unsigned long long value;
+		uint64_t scale = 1;
+
+		if (strncmp(line, "drm-", 4) != 0 ||
+		    sscanf(line, "%47[^:]: %llu %7s", key, &value, unit) < 2)
+			continue;
+		/* engines are in ns, and nothing else has units */
+		if (strcmp(unit, "KiB") == 0)
+			scale = 1024;
+		else if (strcmp(unit, "MiB") == 0)
+			scale = 1024 * 1024;
+		else if (strcmp(unit, "") != 0)
+			continue;
+		if (strncmp(key, "drm-total-", 10) != 0 &&
+		    strncmp(key, "drm-resident-", 13) != 0 &&
+		    strncmp(key, "drm-memory-", 11) != 0 &&
+		    strncmp(key, "drm-shared-", 11) != 0 &&
+		    strncmp(key, "drm-purgeable-", 14) != 0 &&
+		    strncmp(key, "drm-active-", 11) != 0)
+			continue;
+
+		strcpy(mem->keys[mem->count], key);
+		mem->bytes[mem->count] = value * scale;
+		mem->count++;
+	}
+	fclose(f);
+}
+
+static void print_drm_memory(char const * __restrict what,
+                             struct drm_memory const * __restrict before,
+                             struct drm_memory const * __restrict after)
+{
+	if (!after->count) {
+		printf("  %s : no drm-* memory keys in fdinfo\n", what);
+		return;
+	}
+
+	for (int k = 0; k < after->count; k++) {
+		uint64_t start = 0;
+
+		for (int b = 0; b < before->count; b++)
+			if (strcmp(before->keys[b], after->keys[k]) == 0)
+				start = before->bytes[b];
+		printf("  %s %-24s %10.1f MiB -> %10.1f MiB (%+.1f MiB)\n",
+		       what, after->keys[k], start / 1048576.0,
+		       after->bytes[k] / 1048576.0,
+		       ((double) after->bytes[k] - start) / 1048576.0);
+	}
+}
+
+static void close_handle(int fd, uint32_t handle)
+{
+	struct drm_gem_close close_request = {
+		.handle = handle
+	};
+
+	ioctl(fd, DRM_IOCTL_GEM_CLOSE, &close_request);
+}
+
+/* Returns the stage that failed, or -1 */
+static int stress_create(
+	int kms_fd, struct gbm_device * __restrict gbm,
+	enum bo_path path, uint32_t width, uint32_t height,
+	int f, struct stress_bo * __restrict sbo,
+	uint64_t ns[OP_COUNT])
+{
+	uint64_t t;
+
+	sbo->path = path;
+	sbo->bo = NULL;
+	sbo->dma_buf_fd = -1;
+	sbo->handle = 0;
+
+	if (path == BO_PATH_GBM) {
+		t = now_ns();
+		sbo->bo = gbm_bo_create(gbm, width, height,
+		                        stress_formats[f].format,
+		                        GBM_BO_USE_RENDERING);
+		ns[OP_CREATE] = now_ns() - t;
+		if (!sbo->bo)
+			return OP_CREATE;
+
+		t = now_ns();
+		sbo->dma_buf_fd = gbm_bo_get_fd(sbo->bo);
+		ns[OP_EXPORT] = now_ns() - t;
+		if (sbo->dma_buf_fd < 0)
+			return OP_EXPORT;
+
+		t = now_ns();
+		if (drmPrimeFDToHandle(kms_fd, sbo->dma_buf_fd, &sbo->handle)) {
+			sbo->handle = 0;
+			return OP_IMPORT;
+		}
+		ns[OP_IMPORT] = now_ns() - t;
+
+		return -1;
+	}
+
+	struct drm_mode_create_dumb create_request = {
+		.width  = width,
+		.height = height,
+		.bpp    = stress_formats[f].bpp
+	};
+	struct drm_prime_handle prime_request = {
+		.flags = DRM_CLOEXEC | DRM_RDWR,
+		.fd    = -1
+	};
+
+	t = now_ns();
+	if (ioctl(kms_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_request))
+		return OP_CREATE;
+	ns[OP_CREATE] = now_ns() - t;
+	sbo->handle = create_request.handle;
+
+	t = now_ns();
+	prime_request.handle = sbo->handle;
+	if (ioctl(kms_fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime_request))
+		return OP_EXPORT;
+	ns[OP_EXPORT] = now_ns() - t;
+	sbo->dma_buf_fd = prime_request.fd;
+
+	struct gbm_import_fd_data data = {
+		.fd     = sbo->dma_buf_fd,
+		.width  = width,
+		.height = height,
+		.stride = create_request.pitch,
+		.format = stress_formats[f].format
+	};
+
+	t = now_ns();
+	sbo->bo = gbm_bo_import(gbm, GBM_BO_IMPORT_FD, &data,
+	                        GBM_BO_USE_RENDERING);
+	ns[OP_IMPORT] = now_ns() - t;
+	if (!sbo->bo)
+		return OP_IMPORT;
+
+	return -1;
+}
+
+static void stress_destroy(int kms_fd, struct stress_bo * __restrict sbo)
+{
+	if (sbo->bo)
+		gbm_bo_destroy(sbo->bo);
+	if (sbo->dma_buf_fd >= 0)
+		close(sbo->dma_buf_fd);
+	if (sbo->handle) {
+		if (sbo->path == BO_PATH_DUMB) {
+			struct drm_mode_destroy_dumb destroy_request = {
+				.handle = sbo->handle
+			};
+
+			ioctl(kms_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_request);
+		} else {
+			close_handle(kms_fd, sbo->handle);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char const *kms_dev = "/dev/dri/card0";
+	char const *gpu_dev = "/dev/dri/renderD128";
+	int seconds = 60, interval = 10, max_live = 256;
+	unsigned int seed = time(NULL);
+	int ret = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "seconds=", 8) == 0)
+			seconds = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "interval=", 9) == 0)
+			interval = atoi(argv[i] + 9);
+		else if (strncmp(argv[i], "live=", 5) == 0)
+			max_live = atoi(argv[i] + 5);
+		else if (strncmp(argv[i], "seed=", 5) == 0)
+			seed = strtoul(argv[i] + 5, NULL, 0);
+		else if (strncmp(argv[i], "kms=", 4) == 0)
+			kms_dev = argv[i] + 4;
+		else if (strncmp(argv[i], "gpu=", 4) == 0)
+			gpu_dev = argv[i] + 4;
+	}
+	if (max_live < 1)
+		max_live = 1;
+	if (interval < 1)
+		interval = 1;
+
+	int const kms_fd = open(kms_dev, O_RDWR | O_CLOEXEC);
+	if (kms_fd < 0) {
+		LOG("Could not open %s : %m\n", kms_dev);
+		return 1;
+	}
+
+	int const gpu_fd = open(gpu_dev, O_RDWR | O_CLOEXEC);
+	if (gpu_fd < 0) {
+		LOG("Could not open %s : %m\n", gpu_dev);
+		goto could_not_open_gpu;
+	}
+
+	struct gbm_device * __restrict gbm = gbm_create_device(gpu_fd);
+	if (!gbm) {
+		LOG("Could not create a GBM device on %s\n", gpu_dev);
+		goto could_not_create_gbm;
+	}
+
+	struct stress_bo * __restrict live = calloc(max_live, sizeof(*live));
+	if (!live) {
+		LOG("Could not allocate %d slots\n", max_live);
+		goto could_not_allocate_slots;
+	}
+
+	/* The whole run, and the current interval */
+	struct samples total[OP_COUNT] = { 0 }, recent[OP_COUNT] = { 0 };
+	uint64_t failures[2][OP_COUNT] = { { 0 } };
+	uint64_t bytes_created = 0, created = 0;
+	int live_count = 0;
+
+	struct drm_memory kms_start, gpu_start, kms_now, gpu_now;
+	uint64_t const rss_start = process_memory("VmRSS");
+	uint64_t const vsz_start = process_memory("VmSize");
+
+	read_drm_memory(kms_fd, &kms_start);
+	read_drm_memory(gpu_fd, &gpu_start);
+
+	printf("%d s, up to %d buffers alive, seed %u\n",
+	       seconds, max_live, seed);
+	srand(seed);
+
+	uint64_t const start = now_ns();
+	uint64_t const end = start + seconds * 1000000000ull;
+	uint64_t next_report = start + interval * 1000000000ull;
+
+	for (uint64_t t = start; t < end; t = now_ns()) {
+		/* Hover around half full, so both get exercised */
+		int const destroy = live_count == max_live ||
+			(live_count && rand() % max_live < live_count);
+
+		if (destroy) {
+			int const victim = rand() % live_count;
+			uint64_t const before = now_ns();
+
+			stress_destroy(kms_fd, &live[victim]);
+			samples_add(&total[OP_DESTROY], now_ns() - before);
+			samples_add(&recent[OP_DESTROY], now_ns() - before);
+			live[victim] = live[--live_count];
+		} else {
+			enum bo_path const path = rand() % 2;
+			int const f = rand() % ARRAY_SIZE(stress_formats);
+			uint32_t width, height;
+			uint64_t ns[OP_COUNT];
+			int failed;
+
+			if (rand() % 2) {
+				int const s = rand() % ARRAY_SIZE(stress_sizes);
+
+				width = stress_sizes[s][0];
+				height = stress_sizes[s][1];
+			} else {
+				width = 1 + rand() % 4096;
+				height = 1 + rand() % 4096;
+			}
+
+			failed = stress_create(kms_fd, gbm, path, width, height, f,
+			                       &live[live_count], ns);
+			if (failed >= 0) {
+				failures[path][failed]++;
+				stress_destroy(kms_fd, &live[live_count]);
+			} else {
+				for (int op = OP_CREATE; op <= OP_IMPORT; op++) {
+					samples_add(&total[op], ns[op]);
+					samples_add(&recent[op], ns[op]);
+				}
+				bytes_created += (uint64_t) width * height *
+				                 stress_formats[f].bpp / 8;
+				created++;
+				live_count++;
+			}
+		}
+
+		if (t < next_report)
+			continue;
+		next_report += interval * 1000000000ull;
+
+		read_drm_memory(kms_fd, &kms_now);
+		read_drm_memory(gpu_fd, &gpu_now);
+		printf("\n%6.0f s : %llu created, %d alive, rss %llu kB\n",
+		       (t - start) / 1e9, (unsigned long long) created,
+		       live_count, (unsigned long long) process_memory("VmRSS"));
+		for (int op = 0; op < OP_COUNT; op++) {
+			print_samples(op_names[op], &recent[op]);
+			recent[op].count = 0;
+		}
+		print_drm_memory("kms", &kms_start, &kms_now);
+		print_drm_memory("gpu", &gpu_start, &gpu_now);
+	}
+
+	/* What's left alive still counts, so note memory before letting go */
+	read_drm_memory(kms_fd, &kms_now);
+	read_drm_memory(gpu_fd, &gpu_now);
+	uint64_t const rss_end = process_memory("VmRSS");
+	uint64_t const vsz_end = process_memory("VmSize");
+
+	while (live_count)
+		stress_destroy(kms_fd, &live[--live_count]);
+
+	struct drm_memory kms_after, gpu_after;
+
+	read_drm_memory(kms_fd, &kms_after);
+	read_drm_memory(gpu_fd, &gpu_after);
+
+	printf("\nwhole run : %llu buffers, %.1f GiB created\n",
+	       (unsigned long long) created, bytes_created / 1073741824.0);
+	for (int op = 0; op < OP_COUNT; op++)
+		print_samples(op_names[op], &total[op]);
+
+	printf("failures :\n");
+	for (int p = 0; p < 2; p++)
+		printf("  %-8s create %llu, export %llu, import %llu\n",
+		       bo_path_names[p],
+		       (unsigned long long) failures[p][OP_CREATE],
+		       (unsigned long long) failures[p][OP_EXPORT],
+		       (unsigned long long) failures[p][OP_IMPORT]);
+
+	printf("process : rss %llu -> %llu kB, size %llu -> %llu kB\n",
+	       (unsigned long long) rss_start, (unsigned long long) rss_end,
+	       (unsigned long long) vsz_start, (unsigned long long) vsz_end);
+	printf("drivers, at the end of the run :\n");
+	print_drm_memory("kms", &kms_start, &kms_now);
+	print_drm_memory("gpu", &gpu_start, &gpu_now);
+	printf("drivers, with everything destroyed :\n");
+	print_drm_memory("kms", &kms_start, &kms_after);
+	print_drm_memory("gpu", &gpu_start, &gpu_after);
+
+	ret = 0;
+
+	for (int op = 0; op < OP_COUNT; op++) {
+		free(total[op].ns);
+		free(recent[op].ns);
+	}
+	free(live);
+could_not_allocate_slots:
+	gbm_device_destroy(gbm);
+could_not_create_gbm:
+	close(gpu_fd);
+could_not_open_gpu:
+	close(kms_fd);
+	return ret;
+}
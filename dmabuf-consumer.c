@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <linux/dma-buf.h>
+
+#include <drm_fourcc.h>
+
+#include "frame-ipc.h"
+#include "latency.h"
+
+/* The display half of a renderer / display process split, see
+ * dmabuf-producer.c for the other one.
+ *
+ * Buffers are imported, here mapped, once when the producer announces
+ * them. After that each frame is a buffer number and maybe a fence :
+ * wait for it, read the frame back through the mapping the way a display
+ * process without a scanout path would, and release the buffer.
+ *
+ * Reports how long the frames took to get here, how long the fences kept
+ * us waiting, and how long reading back took.
+ */
+
+#define LOG(msg, ...) \
+	fprintf(\
+		stderr, "\n[%s (%s:%d)]\n"msg,\
+		__func__, __FILE__, __LINE__, ##__VA_ARGS__ \
+	)
+
+#define MAX_BUFFERS 8
+
+struct consumer_buffer {
+	int dma_buf_fd;
+	uint8_t *map;
+	uint64_t size;
+	uint32_t width, height, stride, offset;
+};
+
+static int import_buffer(const struct frame_msg *msg, int fd,
+		struct consumer_buffer *buffer)
+{
+	if (msg->format != DRM_FORMAT_XRGB8888 ||
+	    (msg->modifier != DRM_FORMAT_MOD_LINEAR &&
+	     msg->modifier != DRM_FORMAT_MOD_INVALID)) {
+		LOG("Can only read back linear XRGB8888, not %.4s 0x%016llx\n",
+		    (const char *) &msg->format,
+		    (unsigned long long) msg->modifier);
+		return -1;
+	}
+
+	buffer->dma_buf_fd = fd;
+	buffer->width = msg->width;
+	buffer->height = msg->height;
+	buffer->stride = msg->stride;
+	buffer->offset = msg->offset;
+
+	/* The dma-buf knows its real size */
+	buffer->size = lseek(fd, 0, SEEK_END);
+	if (buffer->size == (uint64_t) -1)
+		buffer->size = msg->offset + (uint64_t) msg->stride * msg->height;
+
+	buffer->map = mmap(NULL, buffer->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (buffer->map == MAP_FAILED) {
+		LOG("Could not map buffer %u : %m\n", msg->buffer);
+		buffer->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Twice as many, keeping what's there on failure */
+static int grow(uint64_t **ns, size_t count)
+{
+	uint64_t *grown = realloc(*ns, count * 2 * sizeof(*grown));
+
+	if (!grown)
+		return -1;
+	*ns = grown;
+
+	return 0;
+}
+
+static int wait_fence(int fence_fd)
+{
+	struct pollfd pfd = {
+		.fd = fence_fd,
+		.events = POLLIN,
+	};
+
+	while (poll(&pfd, 1, -1) < 0)
+		if (errno != EINTR)
+			return -1;
+
+	return 0;
+}
+
+/* Read every pixel, as a copy out would, and keep something of it so
+ * none of it is optimized away */
+static uint32_t read_back(struct consumer_buffer *buffer)
+{
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ
+	};
+	uint32_t sum = 0;
+
+	/* Not every exporter needs it, but the caches might */
+	ioctl(buffer->dma_buf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	for (uint32_t y = 0; y < buffer->height; y++) {
+		const uint32_t *row = (const uint32_t *)
+			(buffer->map + buffer->offset + (uint64_t) y * buffer->stride);
+
+		for (uint32_t x = 0; x < buffer->width; x++)
+			sum += row[x];
+	}
+
+	sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+	ioctl(buffer->dma_buf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+	return sum;
+}
+
+int main(int argc, char **argv)
+{
+	char const *socket_path = FRAME_IPC_SOCKET;
+	int readback = 1;
+	int ret = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "socket=", 7) == 0)
+			socket_path = argv[i] + 7;
+		else if (strcmp(argv[i], "noreadback") == 0)
+			/* just the handoff */
+			readback = 0;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int const sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	if (sock < 0 ||
+	    connect(sock, (struct sockaddr *) &addr, sizeof(addr))) {
+		LOG("Could not connect to %s : %m\n", socket_path);
+		goto could_not_connect;
+	}
+
+	struct consumer_buffer buffers[MAX_BUFFERS];
+	int imported = 0;
+
+	/* Grown as frames come, we don't know how many there will be */
+	size_t allocated = 1024;
+	uint64_t *ipc_ns = malloc(allocated * sizeof(*ipc_ns));
+	uint64_t *fence_ns = malloc(allocated * sizeof(*fence_ns));
+	uint64_t *readback_ns = malloc(allocated * sizeof(*readback_ns));
+	int frames = 0, fenced = 0;
+	uint64_t bytes = 0, start = 0;
+	uint32_t checksum = 0;
+
+	if (!ipc_ns || !fence_ns || !readback_ns) {
+		LOG("Out of memory\n");
+		goto out;
+	}
+
+	for (;;) {
+		struct frame_msg msg;
+		int fd;
+
+		if (frame_msg_recv(sock, &msg, &fd)) {
+			LOG("The producer went away\n");
+			break;
+		}
+		uint64_t const received = now_ns();
+
+		if (msg.type == FRAME_MSG_DONE) {
+			ret = 0;
+			break;
+		}
+
+		if (msg.type == FRAME_MSG_BUFFER) {
+			if (msg.buffer != (uint32_t) imported || imported == MAX_BUFFERS ||
+			    fd < 0 || import_buffer(&msg, fd, &buffers[imported])) {
+				if (fd >= 0)
+					close(fd);
+				LOG("Could not import buffer %u\n", msg.buffer);
+				break;
+			}
+			printf("buffer %u : %ux%u, stride %u, modifier 0x%016llx\n",
+			       msg.buffer, msg.width, msg.height, msg.stride,
+			       (unsigned long long) msg.modifier);
+			imported++;
+			continue;
+		}
+
+		if (msg.type != FRAME_MSG_FRAME || msg.buffer >= (uint32_t) imported) {
+			if (fd >= 0)
+				close(fd);
+			LOG("Unexpected message %u for buffer %u\n", msg.type, msg.buffer);
+			break;
+		}
+
+		if (!start)
+			start = received;
+
+		if ((size_t) frames == allocated) {
+			if (grow(&ipc_ns, allocated) || grow(&fence_ns, allocated) ||
+			    grow(&readback_ns, allocated)) {
+				if (fd >= 0)
+					close(fd);
+				LOG("Out of memory\n");
+				break;
+			}
+			allocated *= 2;
+		}
+
+		ipc_ns[frames] = received - msg.sent_ns;
+
+		if (fd >= 0) {
+			uint64_t const t = now_ns();
+
+			wait_fence(fd);
+			close(fd);
+			fence_ns[fenced++] = now_ns() - t;
+		}
+
+		if (readback) {
+			struct consumer_buffer *buffer = &buffers[msg.buffer];
+			uint64_t const t = now_ns();
+
+			checksum += read_back(buffer);
+			readback_ns[frames] = now_ns() - t;
+			bytes += (uint64_t) buffer->width * buffer->height * 4;
+		}
+		frames++;
+
+		struct frame_msg release = {
+			.type    = FRAME_MSG_RELEASE,
+			.buffer  = msg.buffer,
+			.frame   = msg.frame,
+			.sent_ns = msg.sent_ns,
+		};
+
+		if (frame_msg_send(sock, &release, -1)) {
+			LOG("Could not release frame %llu : %m\n",
+			    (unsigned long long) msg.frame);
+			break;
+		}
+	}
+
+	if (frames) {
+		double const seconds = (now_ns() - start) / 1e9;
+		uint64_t read_ns = 0;
+
+		printf("%d frames in %.2f s : %.1f fps (checksum %08x)\n",
+		       frames, seconds, frames / seconds, checksum);
+		print_latencies("ipc", ipc_ns, frames);
+		print_latencies("fence", fence_ns, fenced);
+		if (readback) {
+			for (int f = 0; f < frames; f++)
+				read_ns += readback_ns[f];
+			print_latencies("readback", readback_ns, frames);
+			printf("readback at %.2f GB/s\n", bytes / (double) read_ns);
+		}
+	}
+
+out:
+	free(ipc_ns);
+	free(fence_ns);
+	free(readback_ns);
+	for (int b = 0; b < imported; b++) {
+		munmap(buffers[b].map, buffers[b].size);
+		close(buffers[b].dma_buf_fd);
+	}
+could_not_connect:
+	if (sock >= 0)
+		close(sock);
+	return ret;
+}
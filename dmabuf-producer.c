@@ -0,0 +1,341 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <gbm.h>
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+#include <drm_fourcc.h>
+
+#include "fbo-cache.h"
+#include "frame-ipc.h"
+#include "latency.h"
+
+/* The renderer half of a renderer / display process split, see
+ * dmabuf-consumer.c for the other one.
+ *
+ * Renders into a few dma-bufs in turn and hands each frame over to
+ * whoever connects to the socket, with a fence when the driver can make
+ * a sync_file out of one, so the consumer waits for the GPU and not us.
+ * A buffer is only rendered to again once the consumer released it.
+ *
+ * Runs anywhere GBM and EGL do. Without a GPU, load vgem and point
+ * device= at its node : Mesa then renders with llvmpipe, and waits for it
+ * before sending since there are no fences to hand out.
+ */
+
+#define LOG(msg, ...) \
+	fprintf(\
+		stderr, "\n[%s (%s:%d)]\n"msg,\
+		__func__, __FILE__, __LINE__, ##__VA_ARGS__ \
+	)
+
+#define MAX_BUFFERS 8
+
+struct producer_buffer {
+	struct gbm_bo *bo;
+	int dma_buf_fd;
+	struct cached_fbo target;
+	int busy;
+};
+
+/* Something different every frame, so a consumer that shows or checks
+ * them can tell */
+static void render(struct producer_buffer *buffer, uint64_t frame)
+{
+	uint32_t const width = buffer->target.width;
+	uint32_t const height = buffer->target.height;
+	uint32_t const band = height / 8;
+	float const shade = (frame % 60) / 60.0f;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, buffer->target.fbo);
+	glViewport(0, 0, width, height);
+
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(shade, 0.2, 1 - shade, 1);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, frame * 8 % (height - band), width, band);
+	glClearColor(1, 1, 1, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+}
+
+/* A sync_file the consumer can poll() on, or -1 once the GPU is done */
+static int finish_frame(EGLDisplay dpy, int native_fences)
+{
+	static const EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+		EGL_NONE
+	};
+	EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+	int fence_fd = -1;
+
+	if (native_fences)
+		sync = eglCreateSyncKHR(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+
+	if (sync == EGL_NO_SYNC_KHR) {
+		glFinish();
+		return -1;
+	}
+
+	/* The fd only exists once the fence made it to the driver */
+	glFlush();
+	fence_fd = eglDupNativeFenceFDANDROID(dpy, sync);
+	eglDestroySyncKHR(dpy, sync);
+	if (fence_fd < 0)
+		glFinish();
+
+	return fence_fd;
+}
+
+static int wait_release(int sock, struct producer_buffer *buffers,
+		int count, uint64_t *round_trip_ns, int *releases)
+{
+	struct frame_msg msg;
+	int fd;
+
+	if (frame_msg_recv(sock, &msg, &fd)) {
+		LOG("The consumer went away\n");
+		return -1;
+	}
+	if (fd >= 0)
+		close(fd);
+	if (msg.type != FRAME_MSG_RELEASE || msg.buffer >= (uint32_t) count) {
+		LOG("Unexpected message %u for buffer %u\n", msg.type, msg.buffer);
+		return -1;
+	}
+
+	buffers[msg.buffer].busy = 0;
+	round_trip_ns[(*releases)++] = now_ns() - msg.sent_ns;
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char const *device = "/dev/dri/renderD128";
+	char const *socket_path = FRAME_IPC_SOCKET;
+	uint32_t width = 1920, height = 1080;
+	int count = 3, frames = 600;
+	int ret = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "device=", 7) == 0)
+			device = argv[i] + 7;
+		else if (strncmp(argv[i], "socket=", 7) == 0)
+			socket_path = argv[i] + 7;
+		else if (strncmp(argv[i], "size=", 5) == 0)
+			sscanf(argv[i] + 5, "%ux%u", &width, &height);
+		else if (strncmp(argv[i], "buffers=", 8) == 0)
+			count = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "frames=", 7) == 0)
+			frames = atoi(argv[i] + 7);
+	}
+	if (count < 1)
+		count = 1;
+	if (count > MAX_BUFFERS)
+		count = MAX_BUFFERS;
+	if (height < 16)
+		height = 16;
+
+	int const fd = open(device, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		LOG("Could not open %s : %m\n", device);
+		return 1;
+	}
+
+	struct gbm_device *gbm = gbm_create_device(fd);
+	if (!gbm) {
+		LOG("Could not create a GBM device on %s\n", device);
+		goto could_not_create_gbm;
+	}
+
+	EGLDisplay dpy = eglGetDisplay(gbm);
+	EGLint major, minor;
+	if (!eglInitialize(dpy, &major, &minor)) {
+		LOG("Could not initialize EGL on %s\n", device);
+		goto could_not_init_egl;
+	}
+	printf("EGL %s on %s\n", eglQueryString(dpy, EGL_VERSION), device);
+
+	static const EGLint ctx_attribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	static const EGLint config_attribs[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint num_configs;
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+	if (!eglChooseConfig(dpy, config_attribs, &config, 1, &num_configs) ||
+	    !num_configs) {
+		LOG("No GLES2 config\n");
+		goto could_not_create_context;
+	}
+	EGLContext ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT,
+	                                  ctx_attribs);
+	if (ctx == EGL_NO_CONTEXT ||
+	    !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+		LOG("Could not create a surfaceless context : 0x%x\n",
+		    eglGetError());
+		goto could_not_create_context;
+	}
+
+	int const native_fences =
+		epoxy_has_egl_extension(dpy, "EGL_ANDROID_native_fence_sync");
+	printf("%s\n", native_fences ?
+	       "sending sync_file fences" : "no native fences, waiting before sending");
+
+	struct producer_buffer buffers[MAX_BUFFERS] = { 0 };
+	int created = 0;
+
+	for (; created < count; created++) {
+		struct producer_buffer *buffer = &buffers[created];
+
+		buffer->bo = gbm_bo_create(gbm, width, height, GBM_FORMAT_XRGB8888,
+		                           GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR);
+		if (!buffer->bo) {
+			LOG("Could not create bo : %m\n");
+			goto could_not_create_buffers;
+		}
+		buffer->dma_buf_fd = gbm_bo_get_fd(buffer->bo);
+		if (buffer->dma_buf_fd < 0 ||
+		    fbo_create(dpy, buffer->bo, &buffer->target)) {
+			LOG("Could not export or render to bo\n");
+			gbm_bo_destroy(buffer->bo);
+			if (buffer->dma_buf_fd >= 0)
+				close(buffer->dma_buf_fd);
+			goto could_not_create_buffers;
+		}
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int const listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+	unlink(socket_path);
+	if (listener < 0 ||
+	    bind(listener, (struct sockaddr *) &addr, sizeof(addr)) ||
+	    listen(listener, 1)) {
+		LOG("Could not listen on %s : %m\n", socket_path);
+		goto could_not_listen;
+	}
+
+	printf("waiting for a consumer on %s\n", socket_path);
+	int const sock = accept(listener, NULL, NULL);
+	if (sock < 0) {
+		LOG("accept failed : %m\n");
+		goto could_not_accept;
+	}
+
+	/* The consumer imports them once, and gets buffer numbers after that */
+	for (int b = 0; b < count; b++) {
+		struct frame_msg msg = {
+			.type     = FRAME_MSG_BUFFER,
+			.buffer   = b,
+			.width    = width,
+			.height   = height,
+			.format   = gbm_bo_get_format(buffers[b].bo),
+			.stride   = gbm_bo_get_stride(buffers[b].bo),
+			.offset   = gbm_bo_get_offset(buffers[b].bo, 0),
+			.modifier = gbm_bo_get_modifier(buffers[b].bo),
+		};
+
+		if (frame_msg_send(sock, &msg, buffers[b].dma_buf_fd)) {
+			LOG("Could not send buffer %d : %m\n", b);
+			goto could_not_send;
+		}
+	}
+
+	uint64_t *render_ns = calloc(frames, sizeof(*render_ns));
+	uint64_t *round_trip_ns = calloc(frames, sizeof(*round_trip_ns));
+	int releases = 0, sent = 0;
+
+	assert(render_ns && round_trip_ns);
+
+	uint64_t const start = now_ns();
+	for (; sent < frames; sent++) {
+		int b = sent % count;
+
+		/* Frames come back in order, so waiting for this one is enough */
+		while (buffers[b].busy)
+			if (wait_release(sock, buffers, count, round_trip_ns, &releases))
+				goto consumer_gone;
+
+		uint64_t const t = now_ns();
+
+		render(&buffers[b], sent);
+		int const fence_fd = finish_frame(dpy, native_fences);
+		render_ns[sent] = now_ns() - t;
+
+		struct frame_msg msg = {
+			.type    = FRAME_MSG_FRAME,
+			.buffer  = b,
+			.frame   = sent,
+			.sent_ns = now_ns(),
+		};
+
+		buffers[b].busy = 1;
+		ret = frame_msg_send(sock, &msg, fence_fd);
+		if (fence_fd >= 0)
+			close(fence_fd);
+		if (ret) {
+			LOG("Could not send frame %d : %m\n", sent);
+			goto consumer_gone;
+		}
+	}
+
+	while (releases < sent)
+		if (wait_release(sock, buffers, count, round_trip_ns, &releases))
+			goto consumer_gone;
+
+consumer_gone:;
+	double const seconds = (now_ns() - start) / 1e9;
+	struct frame_msg done = { .type = FRAME_MSG_DONE };
+
+	frame_msg_send(sock, &done, -1);
+
+	printf("%ux%u, %d buffers, %d frames sent, %d released in %.2f s : %.1f fps\n",
+	       width, height, count, sent, releases, seconds, releases / seconds);
+	print_latencies("render", render_ns, sent);
+	print_latencies("round trip", round_trip_ns, releases);
+	ret = releases == frames ? 0 : 1;
+
+	free(render_ns);
+	free(round_trip_ns);
+could_not_send:
+	close(sock);
+could_not_accept:
+	unlink(socket_path);
+could_not_listen:
+	if (listener >= 0)
+		close(listener);
+could_not_create_buffers:
+	for (int b = 0; b < created; b++) {
+		fbo_destroy(dpy, &buffers[b].target);
+		close(buffers[b].dma_buf_fd);
+		gbm_bo_destroy(buffers[b].bo);
+	}
+	eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(dpy, ctx);
+could_not_create_context:
+	eglTerminate(dpy);
+could_not_init_egl:
+	gbm_device_destroy(gbm);
+could_not_create_gbm:
+	close(fd);
+	return ret;
+}
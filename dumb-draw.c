@@ -0,0 +1,698 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dumb-draw.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+/* Below that, waking threads up costs more than it saves */
+#define MIN_BAND_BYTES (256 * 1024)
+#define MAX_THREADS 32
+
+/* Row kernels, picked once by dumb_draw_init */
+static void (*row_fill)(uint32_t *dst, uint32_t n, uint32_t color);
+static void (*row_copy)(uint32_t *dst, const uint32_t *src, uint32_t n);
+static void (*store_fence)(void);
+static const char *isa = "c";
+static int thread_count = 1;
+
+/* Draw threads, started once by dumb_draw_init. dumb_draw_run hands the
+ * parts of one operation out and waits for them all to be done. */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	pthread_t threads[MAX_THREADS];
+	int started;
+	int quit;
+
+	void (*job)(void *data, int index);
+	void *data;
+	int next, count;
+	/* handed out but not done yet */
+	int pending;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+static void *pool_worker(void *data);
+
+static void row_fill_c(uint32_t *dst, uint32_t n, uint32_t color)
+{
+	while (n--)
+		*dst++ = color;
+}
+
+static void row_copy_c(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+	memcpy(dst, src, n * sizeof(*dst));
+}
+
+static void fence_none(void)
+{
+}
+
+#ifdef HAVE_X86
+/* Non-temporal stores skip the cache and go straight to the write-combining
+ * buffers, which is exactly what an uncached scanout mapping wants. They
+ * need aligned destinations, so do the ragged edges one pixel at a time. */
+static void row_fill_sse2(uint32_t *dst, uint32_t n, uint32_t color)
+{
+	__m128i const v = _mm_set1_epi32(color);
+
+	for (; n && ((uintptr_t) dst & 15); n--)
+		*dst++ = color;
+	for (; n >= 16; n -= 16, dst += 16) {
+		_mm_stream_si128((__m128i *) dst + 0, v);
+		_mm_stream_si128((__m128i *) dst + 1, v);
+		_mm_stream_si128((__m128i *) dst + 2, v);
+		_mm_stream_si128((__m128i *) dst + 3, v);
+	}
+	for (; n >= 4; n -= 4, dst += 4)
+		_mm_stream_si128((__m128i *) dst, v);
+	while (n--)
+		*dst++ = color;
+}
+
+static void row_copy_sse2(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+	for (; n && ((uintptr_t) dst & 15); n--)
+		*dst++ = *src++;
+	for (; n >= 16; n -= 16, dst += 16, src += 16) {
+		__m128i const a = _mm_loadu_si128((__m128i const *) src + 0);
+		__m128i const b = _mm_loadu_si128((__m128i const *) src + 1);
+		__m128i const c = _mm_loadu_si128((__m128i const *) src + 2);
+		__m128i const d = _mm_loadu_si128((__m128i const *) src + 3);
+		_mm_stream_si128((__m128i *) dst + 0, a);
+		_mm_stream_si128((__m128i *) dst + 1, b);
+		_mm_stream_si128((__m128i *) dst + 2, c);
+		_mm_stream_si128((__m128i *) dst + 3, d);
+	}
+	for (; n >= 4; n -= 4, dst += 4, src += 4)
+		_mm_stream_si128((__m128i *) dst,
+		                 _mm_loadu_si128((__m128i const *) src));
+	while (n--)
+		*dst++ = *src++;
+}
+
+__attribute__((target("avx2")))
+static void row_fill_avx2(uint32_t *dst, uint32_t n, uint32_t color)
+{
+	__m256i const v = _mm256_set1_epi32(color);
+
+	for (; n && ((uintptr_t) dst & 31); n--)
+		*dst++ = color;
+	for (; n >= 32; n -= 32, dst += 32) {
+		_mm256_stream_si256((__m256i *) dst + 0, v);
+		_mm256_stream_si256((__m256i *) dst + 1, v);
+		_mm256_stream_si256((__m256i *) dst + 2, v);
+		_mm256_stream_si256((__m256i *) dst + 3, v);
+	}
+	for (; n >= 8; n -= 8, dst += 8)
+		_mm256_stream_si256((__m256i *) dst, v);
+	while (n--)
+		*dst++ = color;
+}
+
+__attribute__((target("avx2")))
+static void row_copy_avx2(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+	for (; n && ((uintptr_t) dst & 31); n--)
+		*dst++ = *src++;
+	for (; n >= 32; n -= 32, dst += 32, src += 32) {
+		__m256i const a = _mm256_loadu_si256((__m256i const *) src + 0);
+		__m256i const b = _mm256_loadu_si256((__m256i const *) src + 1);
+		__m256i const c = _mm256_loadu_si256((__m256i const *) src + 2);
+		__m256i const d = _mm256_loadu_si256((__m256i const *) src + 3);
+		_mm256_stream_si256((__m256i *) dst + 0, a);
+		_mm256_stream_si256((__m256i *) dst + 1, b);
+		_mm256_stream_si256((__m256i *) dst + 2, c);
+		_mm256_stream_si256((__m256i *) dst + 3, d);
+	}
+	for (; n >= 8; n -= 8, dst += 8, src += 8)
+		_mm256_stream_si256((__m256i *) dst,
+		                    _mm256_loadu_si256((__m256i const *) src));
+	while (n--)
+		*dst++ = *src++;
+}
+
+/* Streaming stores are weakly ordered : make them visible before we tell
+ * anyone, the display engine included, that the frame is done. */
+static void fence_sfence(void)
+{
+	_mm_sfence();
+}
+#endif
+
+#ifdef HAVE_NEON
+/* There's no non-temporal store intrinsic on ARM. Full 64 bytes bursts of
+ * plain stores are what the write-combining buffer merges best anyway. */
+static void row_fill_neon(uint32_t *dst, uint32_t n, uint32_t color)
+{
+	uint32x4_t const v = vdupq_n_u32(color);
+
+	for (; n && ((uintptr_t) dst & 15); n--)
+		*dst++ = color;
+	for (; n >= 16; n -= 16, dst += 16) {
+		vst1q_u32(dst + 0, v);
+		vst1q_u32(dst + 4, v);
+		vst1q_u32(dst + 8, v);
+		vst1q_u32(dst + 12, v);
+	}
+	for (; n >= 4; n -= 4, dst += 4)
+		vst1q_u32(dst, v);
+	while (n--)
+		*dst++ = color;
+}
+
+static void row_copy_neon(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+	for (; n && ((uintptr_t) dst & 15); n--)
+		*dst++ = *src++;
+	for (; n >= 16; n -= 16, dst += 16, src += 16) {
+		uint32x4_t const a = vld1q_u32(src + 0);
+		uint32x4_t const b = vld1q_u32(src + 4);
+		uint32x4_t const c = vld1q_u32(src + 8);
+		uint32x4_t const d = vld1q_u32(src + 12);
+		vst1q_u32(dst + 0, a);
+		vst1q_u32(dst + 4, b);
+		vst1q_u32(dst + 8, c);
+		vst1q_u32(dst + 12, d);
+	}
+	for (; n >= 4; n -= 4, dst += 4, src += 4)
+		vst1q_u32(dst, vld1q_u32(src));
+	while (n--)
+		*dst++ = *src++;
+}
+#endif
+
+void dumb_draw_init(int threads)
+{
+	row_fill = row_fill_c;
+	row_copy = row_copy_c;
+	store_fence = fence_none;
+	isa = "c";
+
+#if defined(HAVE_X86)
+	row_fill = row_fill_sse2;
+	row_copy = row_copy_sse2;
+	store_fence = fence_sfence;
+	isa = "sse2";
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		row_fill = row_fill_avx2;
+		row_copy = row_copy_avx2;
+		isa = "avx2";
+	}
+#elif defined(HAVE_NEON)
+	row_fill = row_fill_neon;
+	row_copy = row_copy_neon;
+	isa = "neon";
+#endif
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	thread_count = threads;
+
+	/* Called again, with maybe another thread count */
+	dumb_draw_fini();
+
+	/* The caller of run_op draws too, so one less. Those that don't
+	 * start leave their bands to the others. */
+	for (; pool.started < thread_count - 1; pool.started++)
+		if (pthread_create(&pool.threads[pool.started], NULL,
+		                   pool_worker, NULL))
+			break;
+}
+
+void dumb_draw_fini(void)
+{
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (int i = 0; i < pool.started; i++)
+		pthread_join(pool.threads[i], NULL);
+	pool.started = 0;
+	pool.quit = 0;
+}
+
+const char *dumb_draw_isa(void)
+{
+	return isa;
+}
+
+int dumb_draw_threads(void)
+{
+	return thread_count;
+}
+
+enum dumb_op_type {
+	OP_FILL,
+	OP_GRADIENT,
+	OP_BLIT,
+	OP_BLEND,
+	OP_SCROLL,
+};
+
+struct dumb_op {
+	enum dumb_op_type type;
+	struct dumb_surface *s;
+	struct dumb_rect r;
+	uint32_t from, to;
+	int vertical;
+	/* where the clipped rectangle starts in the gradient, and its length,
+	 * or how many rows to scroll by */
+	int32_t offset, span;
+	const uint32_t *src;
+	uint32_t src_pitch;
+	/* for horizontal gradients, the one row every row is a copy of */
+	uint32_t *row;
+};
+
+struct band {
+	const struct dumb_op *op;
+	int32_t y0, y1;
+};
+
+static int clip(const struct dumb_surface *s, struct dumb_rect *r)
+{
+	if (r->x < 0) {
+		r->w += r->x;
+		r->x = 0;
+	}
+	if (r->y < 0) {
+		r->h += r->y;
+		r->y = 0;
+	}
+	if (r->x + r->w > (int32_t) s->width)
+		r->w = s->width - r->x;
+	if (r->y + r->h > (int32_t) s->height)
+		r->h = s->height - r->y;
+
+	return r->w > 0 && r->h > 0;
+}
+
+static uint32_t lerp_color(uint32_t from, uint32_t to, uint32_t i, uint32_t n)
+{
+	uint32_t color = 0;
+
+	if (n <= 1)
+		return from;
+
+	for (int shift = 0; shift < 32; shift += 8) {
+		int32_t const a = (from >> shift) & 0xff;
+		int32_t const b = (to >> shift) & 0xff;
+
+		color |= (uint32_t) (a + (b - a) * (int32_t) i / (int32_t) (n - 1))
+		         << shift;
+	}
+
+	return color;
+}
+
+/* d = c * a + d * (1 - a), two channels at a time. Dividing by 256 instead
+ * of 255 is close enough for a test pattern. */
+static void row_blend(uint32_t *dst, uint32_t n, uint32_t color, uint32_t alpha)
+{
+	uint32_t const rb = (color & 0xff00ff) * alpha;
+	uint32_t const g = (color & 0x00ff00) * alpha;
+	uint32_t const inv = 255 - alpha;
+
+	for (; n; n--, dst++) {
+		uint32_t const d = *dst;
+
+		*dst = ((((d & 0xff00ff) * inv + rb) >> 8) & 0xff00ff) |
+		       ((((d & 0x00ff00) * inv + g) >> 8) & 0x00ff00);
+	}
+}
+
+static void draw_band(const struct band * __restrict band)
+{
+	struct dumb_op const * __restrict op = band->op;
+	struct dumb_rect const * __restrict r = &op->r;
+
+	for (int32_t y = band->y0; y < band->y1; y++) {
+		uint32_t * __restrict dst = (uint32_t *)
+			(op->s->map + (uint64_t) (r->y + y) * op->s->pitch) + r->x;
+
+		switch (op->type) {
+		case OP_FILL:
+			row_fill(dst, r->w, op->from);
+			break;
+		case OP_GRADIENT:
+			if (op->vertical)
+				row_fill(dst, r->w,
+				         lerp_color(op->from, op->to,
+				                    op->offset + y, op->span));
+			else
+				row_copy(dst, op->row, r->w);
+			break;
+		case OP_BLIT:
+			row_copy(dst, (uint32_t const *) ((uint8_t const *) op->src +
+			         (uint64_t) y * op->src_pitch), r->w);
+			break;
+		case OP_BLEND:
+			row_blend(dst, r->w, op->from, op->to);
+			break;
+		case OP_SCROLL:
+			/* The last rows keep what they had, for the caller to
+			 * redraw. */
+			if (y + op->offset < r->h)
+				memcpy(dst, dst + op->offset * (op->s->pitch / 4),
+				       r->w * 4);
+			break;
+		}
+	}
+
+	store_fence();
+}
+
+/* Take parts until there are none left, with the pool locked */
+static void run_pending_jobs(void)
+{
+	while (pool.next < pool.count) {
+		int const index = pool.next++;
+
+		pthread_mutex_unlock(&pool.lock);
+		pool.job(pool.data, index);
+		pthread_mutex_lock(&pool.lock);
+
+		if (--pool.pending == 0)
+			pthread_cond_signal(&pool.done);
+	}
+}
+
+static void *pool_worker(void *data)
+{
+	(void) data;
+
+	pthread_mutex_lock(&pool.lock);
+	for (;;) {
+		while (!pool.quit && pool.next >= pool.count)
+			pthread_cond_wait(&pool.work, &pool.lock);
+		if (pool.quit)
+			break;
+		run_pending_jobs();
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+void dumb_draw_run(void (*job)(void *data, int index), void *data, int count)
+{
+	if (count == 1) {
+		job(data, 0);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.job = job;
+	pool.data = data;
+	pool.next = 0;
+	pool.count = pool.pending = count;
+	pthread_cond_broadcast(&pool.work);
+
+	run_pending_jobs();
+	while (pool.pending)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pool.job = NULL;
+	pool.data = NULL;
+	pool.count = pool.next = 0;
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void band_job(void *data, int index)
+{
+	struct band const *bands = data;
+
+	draw_band(&bands[index]);
+}
+
+/* Split the rows of the operation into one band per thread, and draw
+ * bands ourselves too while the workers run. */
+static void run_op(const struct dumb_op *op)
+{
+	struct band bands[MAX_THREADS];
+	uint64_t const bytes = (uint64_t) op->r.w * op->r.h * 4;
+	int n = thread_count;
+
+	if (bytes / MIN_BAND_BYTES < (uint64_t) n)
+		n = bytes / MIN_BAND_BYTES;
+	if (n > op->r.h)
+		n = op->r.h;
+	/* Scrolling reads the rows the next band writes */
+	if (op->type == OP_SCROLL)
+		n = 1;
+	if (n < 1)
+		n = 1;
+
+	for (int i = 0; i < n; i++) {
+		bands[i].op = op;
+		bands[i].y0 = (int64_t) op->r.h * i / n;
+		bands[i].y1 = (int64_t) op->r.h * (i + 1) / n;
+	}
+
+	if (op->s->damage)
+		dumb_damage_add(op->s->damage, &op->r);
+
+	dumb_draw_run(band_job, bands, n);
+}
+
+void dumb_fill(struct dumb_surface *s, const struct dumb_rect *r,
+               uint32_t color)
+{
+	struct dumb_op op = {
+		.type = OP_FILL, .s = s, .r = *r, .from = color
+	};
+
+	if (clip(s, &op.r))
+		run_op(&op);
+}
+
+void dumb_gradient(struct dumb_surface *s, const struct dumb_rect *r,
+                   uint32_t from, uint32_t to, int vertical)
+{
+	struct dumb_op op = {
+		.type = OP_GRADIENT, .s = s, .r = *r,
+		.from = from, .to = to, .vertical = vertical
+	};
+
+	if (!clip(s, &op.r))
+		return;
+
+	/* Keep the colors relative to the unclipped rectangle */
+	op.offset = vertical ? op.r.y - r->y : op.r.x - r->x;
+	op.span = vertical ? r->h : r->w;
+
+	/* Every row of a horizontal gradient is the same : compute it once
+	 * in cached memory and stream copies of it. */
+	if (!vertical) {
+		op.row = malloc(op.r.w * sizeof(*op.row));
+		if (!op.row)
+			return;
+		for (int32_t i = 0; i < op.r.w; i++)
+			op.row[i] = lerp_color(from, to, op.offset + i, op.span);
+	}
+
+	run_op(&op);
+
+	free(op.row);
+}
+
+void dumb_blit(struct dumb_surface *s, const struct dumb_rect *r,
+               const uint32_t *src, uint32_t src_pitch)
+{
+	struct dumb_op op = {
+		.type = OP_BLIT, .s = s, .r = *r,
+		.src = src, .src_pitch = src_pitch
+	};
+
+	if (!clip(s, &op.r))
+		return;
+
+	/* Skip what got clipped on the top and left of the source */
+	op.src = (uint32_t const *) ((uint8_t const *) src +
+	         (uint64_t) (op.r.y - r->y) * src_pitch) + (op.r.x - r->x);
+
+	run_op(&op);
+}
+
+void dumb_blend(struct dumb_surface *s, const struct dumb_rect *r,
+                uint32_t color, uint8_t alpha)
+{
+	struct dumb_op op = {
+		.type = OP_BLEND, .s = s, .r = *r, .from = color, .to = alpha
+	};
+
+	if (clip(s, &op.r))
+		run_op(&op);
+}
+
+void dumb_scroll(struct dumb_surface *s, const struct dumb_rect *r,
+                 int32_t rows)
+{
+	struct dumb_op op = {
+		.type = OP_SCROLL, .s = s, .r = *r, .offset = rows
+	};
+
+	if (clip(s, &op.r) && rows > 0)
+		run_op(&op);
+}
+
+int dumb_shadow_init(struct dumb_surface *shadow,
+                     uint32_t width, uint32_t height)
+{
+	long const page = sysconf(_SC_PAGESIZE);
+
+	memset(shadow, 0, sizeof(*shadow));
+	shadow->width = width;
+	shadow->height = height;
+	/* Whole cache lines per row, whole pages for the buffer */
+	shadow->pitch = (width * 4 + 63) & ~63;
+	shadow->size = ((uint64_t) shadow->pitch * height + page - 1) & ~(page - 1);
+	shadow->map = aligned_alloc(page, shadow->size);
+	if (!shadow->map)
+		return -1;
+
+	memset(shadow->map, 0, shadow->size);
+
+	return 0;
+}
+
+void dumb_shadow_fini(struct dumb_surface *shadow)
+{
+	free(shadow->map);
+	shadow->map = NULL;
+}
+
+void dumb_shadow_flush(struct dumb_surface *scanout,
+                       const struct dumb_surface *shadow,
+                       const struct dumb_damage *d)
+{
+	/* The damage we are walking may well be scanout's own */
+	struct dumb_surface dst = *scanout;
+
+	dst.damage = NULL;
+
+	for (int i = 0; i < d->count; i++) {
+		struct dumb_rect const * __restrict r = &d->rects[i];
+
+		dumb_blit(&dst, r, (uint32_t const *) (shadow->map +
+		          (uint64_t) r->y * shadow->pitch) + r->x, shadow->pitch);
+	}
+}
+
+static int64_t rect_area(const struct dumb_rect *r)
+{
+	return (int64_t) r->w * r->h;
+}
+
+static struct dumb_rect rect_union(const struct dumb_rect *a,
+                                   const struct dumb_rect *b)
+{
+	int32_t const x1 = a->x < b->x ? a->x : b->x;
+	int32_t const y1 = a->y < b->y ? a->y : b->y;
+	int32_t const x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	int32_t const y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+	return (struct dumb_rect) { x1, y1, x2 - x1, y2 - y1 };
+}
+
+void dumb_damage_reset(struct dumb_damage *d)
+{
+	d->count = 0;
+}
+
+void dumb_damage_add(struct dumb_damage *d, const struct dumb_rect *r)
+{
+	struct dumb_rect added = *r;
+
+	if (added.w <= 0 || added.h <= 0)
+		return;
+
+again:
+	/* Fold in every rectangle whose union with ours costs no more than
+	 * the two of them apart : overlapping, nested or side by side. The
+	 * result may now reach others, so start over. */
+	for (int i = 0; i < d->count; i++) {
+		struct dumb_rect const u = rect_union(&added, &d->rects[i]);
+
+		if (rect_area(&u) <= rect_area(&added) + rect_area(&d->rects[i])) {
+			added = u;
+			d->rects[i] = d->rects[--d->count];
+			goto again;
+		}
+	}
+
+	if (d->count == DUMB_MAX_DAMAGE) {
+		int best = 0;
+		int64_t best_growth = INT64_MAX;
+
+		for (int i = 0; i < d->count; i++) {
+			struct dumb_rect const u = rect_union(&added, &d->rects[i]);
+			int64_t const growth = rect_area(&u) - rect_area(&d->rects[i]);
+
+			if (growth < best_growth) {
+				best_growth = growth;
+				best = i;
+			}
+		}
+
+		added = rect_union(&added, &d->rects[best]);
+		d->rects[best] = d->rects[--d->count];
+		goto again;
+	}
+
+	d->rects[d->count++] = added;
+}
+
+uint64_t dumb_damage_bytes(const struct dumb_damage *d)
+{
+	uint64_t bytes = 0;
+
+	for (int i = 0; i < d->count; i++)
+		bytes += rect_area(&d->rects[i]) * 4;
+
+	return bytes;
+}
+
+uint64_t dumb_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void dumb_report(const char *what, const struct dumb_surface *s,
+                 uint64_t bytes, uint64_t ns)
+{
+	if (!ns)
+		ns = 1;
+
+	double const seconds = ns / 1e9;
+
+	printf("%-12s %9.1f MiB in %9.3f ms : %7.2f GB/s, %8.1f buffers/s\n",
+	       what, bytes / (1024.0 * 1024.0), ns / 1e6,
+	       bytes / (double) ns, bytes / (double) s->size / seconds);
+}
@@ -0,0 +1,91 @@
+#ifndef DUMB_DRAW_H
+#define DUMB_DRAW_H
+
+#include <stdint.h>
+
+/* CPU drawing into a mapped linear XRGB8888 scanout buffer.
+ *
+ * Dumb buffer mappings are usually write-combined : reads are uncached and
+ * dreadfully slow, writes are only fast when they fill whole lines. So
+ * every operation here only ever writes the destination, in full vector
+ * stores, bypassing the cache where the CPU lets us.
+ */
+
+struct dumb_rect {
+	int32_t x, y;
+	int32_t w, h;
+};
+
+/* What changed since the last update, so drivers that have to copy or
+ * flush the framebuffer somewhere (udl, SPI panels, vkms...) only touch
+ * that. Overlapping and touching rectangles get merged, and once full,
+ * new ones are merged with whichever grows the least. */
+#define DUMB_MAX_DAMAGE 16
+
+struct dumb_damage {
+	struct dumb_rect rects[DUMB_MAX_DAMAGE];
+	int count;
+};
+
+struct dumb_surface {
+	uint8_t *map;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch; /* in bytes */
+	uint64_t size;
+	/* When set, every operation adds what it drew */
+	struct dumb_damage *damage;
+};
+
+/* Pick the row kernels for this CPU and the number of threads large
+ * operations get split across, by row bands. 0 means one per CPU. */
+void dumb_draw_init(int threads);
+/* Stop the threads dumb_draw_init started */
+void dumb_draw_fini(void);
+/* Call job with every index below count, spread over those threads and
+ * the caller, and return once they're all done */
+void dumb_draw_run(void (*job)(void *data, int index), void *data, int count);
+const char *dumb_draw_isa(void);
+int dumb_draw_threads(void);
+
+void dumb_fill(struct dumb_surface *s, const struct dumb_rect *r,
+               uint32_t color);
+
+/* Linear gradient from 'from' to 'to', left to right or top to bottom */
+void dumb_gradient(struct dumb_surface *s, const struct dumb_rect *r,
+                   uint32_t from, uint32_t to, int vertical);
+
+/* Copy a w x h block of src, starting at its top left, into r */
+void dumb_blit(struct dumb_surface *s, const struct dumb_rect *r,
+               const uint32_t *src, uint32_t src_pitch);
+
+/* These two read the destination back : keep them away from uncached
+ * mappings, and draw into a shadow buffer instead. */
+void dumb_blend(struct dumb_surface *s, const struct dumb_rect *r,
+                uint32_t color, uint8_t alpha);
+/* Move the content of r up by rows, leaving the bottom rows as they were */
+void dumb_scroll(struct dumb_surface *s, const struct dumb_rect *r,
+                 int32_t rows);
+
+/* A cached, page aligned copy of the scanout buffer to draw into. Flushing
+ * copies the damaged rectangles to the real thing with streaming stores. */
+int dumb_shadow_init(struct dumb_surface *shadow,
+                     uint32_t width, uint32_t height);
+void dumb_shadow_fini(struct dumb_surface *shadow);
+void dumb_shadow_flush(struct dumb_surface *scanout,
+                       const struct dumb_surface *shadow,
+                       const struct dumb_damage *d);
+
+void dumb_damage_reset(struct dumb_damage *d);
+void dumb_damage_add(struct dumb_damage *d, const struct dumb_rect *r);
+/* How many bytes of XRGB8888 pixels the damage covers */
+uint64_t dumb_damage_bytes(const struct dumb_damage *d);
+
+uint64_t dumb_now_ns(void);
+
+/* Print the throughput of writing 'bytes' in 'ns', and how that compares
+ * to rewriting the whole buffer. */
+void dumb_report(const char *what, const struct dumb_surface *s,
+                 uint64_t bytes, uint64_t ns);
+
+#endif
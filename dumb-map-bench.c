@@ -0,0 +1,487 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/dma-buf.h>
+#include <libdrm/drm.h>
+
+#include <drm_fourcc.h>
+#include <gbm.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "dumb-draw.h"
+#include "modifiers.h"
+
+/* How fast can the CPU write, read, and read-modify-write a buffer the
+ * display could scan out, depending on how it got mapped ?
+ *
+ * The same size buffer gets allocated and mapped in every way we know of.
+ * Dumb buffers and PRIME mappings are usually write-combined, so expect
+ * reads to crawl. GBM maps of tiled buffers go through a staging copy,
+ * which is paid on every map and unmap.
+ *
+ * The tiled buffer gets one of the modifiers the display can scan out,
+ * linear left out. Left to themselves with just usage flags, many
+ * drivers would pick linear again.
+ */
+
+#define LOG(msg, ...) \
+	fprintf(\
+		stderr, "\n[%s (%s:%d)]\n"msg,\
+		__func__, __FILE__, __LINE__, ##__VA_ARGS__ \
+	)
+
+enum access {
+	ACCESS_WRITE,
+	ACCESS_READ,
+	ACCESS_RMW,
+	ACCESS_COUNT
+};
+
+static char const * const access_names[] = {
+	"write", "read", "rmw"
+};
+
+enum path_type {
+	PATH_MALLOC,
+	PATH_DUMB,
+	PATH_PRIME,
+	PATH_PRIME_SYNC,
+	PATH_GBM,
+};
+
+struct map_path {
+	char const *name;
+	enum path_type type;
+	uint32_t gbm_flags;
+	/* to choose from instead of gbm_flags */
+	uint64_t *modifiers;
+	int modifier_count;
+
+	/* what backs the mapping */
+	uint32_t handle;
+	int prime_fd;
+	struct gbm_bo *bo;
+	void *map_data;
+
+	/* what we get to draw into */
+	uint8_t *map;
+	uint32_t pitch;
+	uint64_t size;
+	uint64_t modifier;
+
+	double gbps[ACCESS_COUNT];
+	int ok;
+};
+
+static int create_dumb(
+	int fd, uint32_t width, uint32_t height,
+	struct map_path * __restrict path)
+{
+	struct drm_mode_create_dumb create_request = {
+		.width  = width,
+		.height = height,
+		.bpp    = 32
+	};
+
+	if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_request)) {
+		LOG("Could not allocate a %ux%u dumb buffer : %m\n", width, height);
+		return -1;
+	}
+
+	path->handle = create_request.handle;
+	path->pitch  = create_request.pitch;
+	path->size   = create_request.size;
+
+	return 0;
+}
+
+static void destroy_dumb(int fd, uint32_t handle)
+{
+	struct drm_mode_destroy_dumb destroy_request = {
+		.handle = handle
+	};
+
+	ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_request);
+}
+
+/* Allocate and, when it stays mapped, map the buffer behind the path */
+static int path_init(
+	int fd, struct gbm_device * __restrict gbm,
+	uint32_t width, uint32_t height,
+	struct map_path * __restrict path)
+{
+	path->prime_fd = -1;
+
+	switch (path->type) {
+	case PATH_MALLOC:
+		path->pitch = width * 4;
+		path->size  = (uint64_t) path->pitch * height;
+		path->map   = aligned_alloc(64, path->size);
+		return path->map ? 0 : -1;
+
+	case PATH_DUMB: {
+		struct drm_mode_map_dumb map_request = { 0 };
+
+		if (create_dumb(fd, width, height, path))
+			return -1;
+
+		map_request.handle = path->handle;
+		if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map_request)) {
+			LOG("Could not get the dumb buffer map offset : %m\n");
+			return -1;
+		}
+
+		path->map = mmap(0, path->size, PROT_READ | PROT_WRITE,
+		                 MAP_SHARED, fd, map_request.offset);
+		break;
+	}
+
+	case PATH_PRIME:
+	case PATH_PRIME_SYNC: {
+		struct drm_prime_handle prime_request = {
+			.flags = DRM_CLOEXEC | DRM_RDWR,
+			.fd    = -1
+		};
+
+		if (create_dumb(fd, width, height, path))
+			return -1;
+
+		prime_request.handle = path->handle;
+		if (ioctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime_request)) {
+			LOG("Could not export the dumb buffer : %m\n");
+			return -1;
+		}
+		path->prime_fd = prime_request.fd;
+
+		path->map = mmap(0, path->size, PROT_READ | PROT_WRITE,
+		                 MAP_SHARED, path->prime_fd, 0);
+		break;
+	}
+
+	case PATH_GBM:
+		/* Mapped on every pass, since that's what costs */
+		if (path->modifier_count)
+			path->bo = gbm_bo_create_with_modifiers(gbm, width, height,
+			                                        GBM_FORMAT_XRGB8888,
+			                                        path->modifiers,
+			                                        path->modifier_count);
+		else
+			path->bo = gbm_bo_create(gbm, width, height,
+			                         GBM_FORMAT_XRGB8888,
+			                         path->gbm_flags);
+		if (!path->bo) {
+			LOG("Could not create the %s buffer : %m\n", path->name);
+			return -1;
+		}
+		path->size = (uint64_t) gbm_bo_get_stride(path->bo) * height;
+		path->modifier = gbm_bo_get_modifier(path->bo);
+		return 0;
+	}
+
+	if (path->map == MAP_FAILED) {
+		LOG("Could not map the %s buffer : %m\n", path->name);
+		path->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void path_fini(int fd, struct map_path * __restrict path)
+{
+	switch (path->type) {
+	case PATH_MALLOC:
+		free(path->map);
+		break;
+	case PATH_GBM:
+		if (path->bo)
+			gbm_bo_destroy(path->bo);
+		break;
+	default:
+		if (path->map)
+			munmap(path->map, path->size);
+		if (path->prime_fd >= 0)
+			close(path->prime_fd);
+		if (path->handle)
+			destroy_dumb(fd, path->handle);
+		break;
+	}
+}
+
+static int dma_buf_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = { .flags = flags };
+	int ret;
+
+	do {
+		ret = ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+	} while (ret && (errno == EINTR || errno == EAGAIN));
+
+	return ret;
+}
+
+/* Get the CPU a pointer it may access the buffer through, the way a real
+ * user of that path would. */
+static int path_begin(
+	struct map_path * __restrict path, enum access access,
+	uint32_t width, uint32_t height)
+{
+	static uint64_t const sync_flags[] = {
+		[ACCESS_WRITE] = DMA_BUF_SYNC_WRITE,
+		[ACCESS_READ]  = DMA_BUF_SYNC_READ,
+		[ACCESS_RMW]   = DMA_BUF_SYNC_RW,
+	};
+	static uint32_t const transfer_flags[] = {
+		[ACCESS_WRITE] = GBM_BO_TRANSFER_WRITE,
+		[ACCESS_READ]  = GBM_BO_TRANSFER_READ,
+		[ACCESS_RMW]   = GBM_BO_TRANSFER_READ_WRITE,
+	};
+
+	switch (path->type) {
+	case PATH_PRIME_SYNC:
+		return dma_buf_sync(path->prime_fd,
+		                    DMA_BUF_SYNC_START | sync_flags[access]);
+	case PATH_GBM:
+		path->map_data = NULL;
+		path->map = gbm_bo_map(path->bo, 0, 0, width, height,
+		                       transfer_flags[access], &path->pitch,
+		                       &path->map_data);
+		return path->map ? 0 : -1;
+	default:
+		return 0;
+	}
+}
+
+static void path_end(struct map_path * __restrict path, enum access access)
+{
+	static uint64_t const sync_flags[] = {
+		[ACCESS_WRITE] = DMA_BUF_SYNC_WRITE,
+		[ACCESS_READ]  = DMA_BUF_SYNC_READ,
+		[ACCESS_RMW]   = DMA_BUF_SYNC_RW,
+	};
+
+	switch (path->type) {
+	case PATH_PRIME_SYNC:
+		dma_buf_sync(path->prime_fd, DMA_BUF_SYNC_END | sync_flags[access]);
+		break;
+	case PATH_GBM:
+		gbm_bo_unmap(path->bo, path->map_data);
+		path->map = NULL;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Plain loops, as a naive software renderer would do them. Reads go 64 bits
+ * at a time and feed a sum, so the compiler can't drop them. */
+static uint64_t read_pixels(
+	uint8_t const * __restrict map, uint32_t pitch,
+	uint32_t width, uint32_t height)
+{
+	uint64_t sum = 0;
+
+	for (uint32_t y = 0; y < height; y++) {
+		uint64_t const * __restrict row =
+			(uint64_t const *) (map + (uint64_t) y * pitch);
+
+		for (uint32_t x = 0; x < width / 2; x++)
+			sum += row[x];
+	}
+
+	return sum;
+}
+
+static void invert_pixels(
+	uint8_t * __restrict map, uint32_t pitch,
+	uint32_t width, uint32_t height)
+{
+	for (uint32_t y = 0; y < height; y++) {
+		uint32_t * __restrict row = (uint32_t *) (map + (uint64_t) y * pitch);
+
+		for (uint32_t x = 0; x < width; x++)
+			row[x] ^= 0xffffff;
+	}
+}
+
+static void run_path(
+	struct map_path * __restrict path, uint32_t width, uint32_t height,
+	int iterations)
+{
+	uint64_t const bytes = (uint64_t) width * height * 4 * iterations;
+	struct dumb_rect const whole = { 0, 0, width, height };
+	uint64_t volatile sink = 0;
+
+	for (int a = 0; a < ACCESS_COUNT; a++) {
+		uint64_t const start = dumb_now_ns();
+		int i;
+
+		for (i = 0; i < iterations; i++) {
+			if (path_begin(path, a, width, height)) {
+				LOG("Could not map %s for %s : %m\n",
+				    path->name, access_names[a]);
+				break;
+			}
+
+			struct dumb_surface surface = {
+				.map    = path->map,
+				.width  = width,
+				.height = height,
+				.pitch  = path->pitch,
+				.size   = path->size
+			};
+
+			switch (a) {
+			case ACCESS_WRITE:
+				dumb_fill(&surface, &whole, i * 0x010101);
+				break;
+			case ACCESS_READ:
+				sink += read_pixels(path->map, path->pitch, width, height);
+				break;
+			case ACCESS_RMW:
+				invert_pixels(path->map, path->pitch, width, height);
+				break;
+			}
+
+			path_end(path, a);
+		}
+
+		uint64_t const ns = dumb_now_ns() - start;
+		path->gbps[a] = i == iterations && ns ? bytes / (double) ns : 0;
+	}
+	(void) sink;
+}
+
+/* What the first CRTC's primary plane scans XRGB8888 out with, linear
+ * left out. 0 when there's nothing else. */
+static int tiled_modifiers(int fd, uint64_t **modifiers)
+{
+	drmModeRes *res = drmModeGetResources(fd);
+	int count = 0, tiled = 0;
+
+	*modifiers = NULL;
+	if (!res)
+		return 0;
+	if (res->count_crtcs)
+		count = kms_plane_modifiers(fd, res->crtcs[0], DRM_FORMAT_XRGB8888,
+		                            modifiers);
+	drmModeFreeResources(res);
+
+	for (int m = 0; m < count; m++)
+		if ((*modifiers)[m] != DRM_FORMAT_MOD_LINEAR &&
+		    (*modifiers)[m] != DRM_FORMAT_MOD_INVALID)
+			(*modifiers)[tiled++] = (*modifiers)[m];
+
+	return tiled;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t width = 1920, height = 1080;
+	int iterations = 20, threads = 1;
+	char const *device = "/dev/dri/card0";
+	int ret = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "size=", 5) == 0)
+			sscanf(argv[i] + 5, "%ux%u", &width, &height);
+		else if (strncmp(argv[i], "iterations=", 11) == 0)
+			iterations = atoi(argv[i] + 11);
+		else if (strncmp(argv[i], "threads=", 8) == 0)
+			threads = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "device=", 7) == 0)
+			device = argv[i] + 7;
+	}
+
+	struct map_path paths[] = {
+		{ .name = "malloc",      .type = PATH_MALLOC },
+		{ .name = "dumb",        .type = PATH_DUMB },
+		{ .name = "prime",       .type = PATH_PRIME },
+		{ .name = "prime+sync",  .type = PATH_PRIME_SYNC },
+		{ .name = "gbm linear",  .type = PATH_GBM,
+		  .gbm_flags = GBM_BO_USE_LINEAR | GBM_BO_USE_RENDERING },
+		{ .name = "gbm tiled",   .type = PATH_GBM },
+	};
+	/* the last one */
+	struct map_path *tiled =
+		&paths[sizeof(paths) / sizeof(paths[0]) - 1];
+
+	int const fd = open(device, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		LOG("Could not open %s : %m\n", device);
+		return 1;
+	}
+
+	struct gbm_device * __restrict gbm = gbm_create_device(fd);
+	if (!gbm) {
+		LOG("Could not create a GBM device on %s\n", device);
+		goto could_not_create_gbm;
+	}
+
+	tiled->modifier_count = tiled_modifiers(fd, &tiled->modifiers);
+	if (!tiled->modifier_count)
+		printf("no tiled XRGB8888 modifier to scan out, no gbm tiled\n");
+
+	dumb_draw_init(threads);
+	printf("%ux%u XRGB8888, %d passes, writes with %s on %d threads\n",
+	       width, height, iterations, dumb_draw_isa(), dumb_draw_threads());
+
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+		struct map_path * __restrict path = &paths[p];
+
+		if (path == tiled && !tiled->modifier_count)
+			continue;
+		path->ok = path_init(fd, gbm, width, height, path) == 0;
+		/* Not what this row is about */
+		if (path->ok && path == tiled &&
+		    path->modifier == DRM_FORMAT_MOD_LINEAR) {
+			printf("gbm tiled came out linear, skipped\n");
+			path->ok = 0;
+			path_fini(fd, path);
+			tiled->modifier_count = 0;
+			continue;
+		}
+		if (path->ok)
+			run_path(path, width, height, iterations);
+		path_fini(fd, path);
+	}
+
+	printf("\n%-12s %18s %10s %10s %10s\n", "mapping", "modifier",
+	       "write", "read", "rmw");
+	for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+		struct map_path const * __restrict path = &paths[p];
+
+		if (path == tiled && !tiled->modifier_count)
+			continue;
+		printf("%-12s", path->name);
+		if (path->type == PATH_GBM && path->ok)
+			printf(" 0x%016llx", (unsigned long long) path->modifier);
+		else
+			printf(" %18s", "-");
+		if (!path->ok) {
+			printf(" %10s %10s %10s\n", "-", "-", "-");
+			continue;
+		}
+		for (int a = 0; a < ACCESS_COUNT; a++)
+			printf(" %5.2f GB/s", path->gbps[a]);
+		printf("\n");
+	}
+	free(tiled->modifiers);
+
+	ret = 0;
+
+	dumb_draw_fini();
+	gbm_device_destroy(gbm);
+could_not_create_gbm:
+	close(fd);
+	return ret;
+}
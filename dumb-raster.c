@@ -0,0 +1,315 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "dumb-raster.h"
+
+#define TILE_SIZE 64
+/* Keeps the edge values within a tile in 32 bits */
+#define MAX_COORD (1 << 13)
+
+/* Eight pixels at a time with the compiler's generic vectors : that's
+ * NEON on ARM, SSE2 on x86, and on x86 GCC also builds an AVX2 copy it
+ * picks at load time when the CPU has it. */
+typedef int32_t v8i __attribute__((vector_size(32)));
+typedef float v8f __attribute__((vector_size(32)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 6
+#define RASTER_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define RASTER_CLONES
+#endif
+
+struct setup {
+	struct dumb_surface *s;
+	/* Edge i, facing vertex i, is A * x + B * y + C in 1/16th of pixels,
+	 * positive inside. C is biased so that pixels right on an edge only
+	 * belong to the triangle on its top or left side. */
+	int64_t A[3], B[3], C[3];
+	/* r, g and b as a * x + b * y + c, in pixels and 0..255 */
+	double plane[3][3];
+	/* bounding box, in pixels, x1 and y1 excluded */
+	int32_t x0, y0, x1, y1;
+	int32_t tiles_x, tiles;
+	atomic_int next_tile;
+};
+
+/* What a tile row needs to shade its pixels */
+struct raster_row {
+	int32_t e[3];
+	int32_t step[3];
+	float c[3];
+	float dc[3];
+};
+
+static int triangle_setup(struct setup * __restrict t, struct dumb_surface *s,
+                          const struct dumb_vertex v[3])
+{
+	struct dumb_vertex const *p[3] = { &v[0], &v[1], &v[2] };
+	int64_t fx[3], fy[3];
+
+	/* Viewport transform. GL puts -1 at the bottom of the screen, which is
+	 * the last row of the scanout buffer. */
+	for (int i = 0; i < 3; i++) {
+		double const sx = (p[i]->x + 1) * s->width / 2;
+		double const sy = (1 - p[i]->y) * s->height / 2;
+
+		if (fabs(sx) > MAX_COORD || fabs(sy) > MAX_COORD)
+			return -1;
+		fx[i] = llround(sx * 16);
+		fy[i] = llround(sy * 16);
+	}
+
+	int64_t area = (fx[1] - fx[0]) * (fy[2] - fy[0]) -
+	               (fy[1] - fy[0]) * (fx[2] - fx[0]);
+	if (area == 0)
+		return -1;
+
+	/* No culling : turn clockwise triangles around */
+	if (area < 0) {
+		struct dumb_vertex const *swap_p = p[1];
+		int64_t swap;
+
+		p[1] = p[2];
+		p[2] = swap_p;
+		swap = fx[1]; fx[1] = fx[2]; fx[2] = swap;
+		swap = fy[1]; fy[1] = fy[2]; fy[2] = swap;
+		area = -area;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		int const a = (i + 1) % 3, b = (i + 2) % 3;
+
+		t->A[i] = fy[a] - fy[b];
+		t->B[i] = fx[b] - fx[a];
+		t->C[i] = fx[a] * fy[b] - fy[a] * fx[b];
+		if (!(t->A[i] > 0 || (t->A[i] == 0 && t->B[i] > 0)))
+			t->C[i] -= 1;
+	}
+
+	double const x0 = fx[0] / 16.0, y0 = fy[0] / 16.0;
+	double const x1 = fx[1] / 16.0 - x0, y1 = fy[1] / 16.0 - y0;
+	double const x2 = fx[2] / 16.0 - x0, y2 = fy[2] / 16.0 - y0;
+	double const d = x1 * y2 - y1 * x2;
+
+	for (int c = 0; c < 3; c++) {
+		double const c0 = (&p[0]->r)[c] * 255;
+		double const c1 = (&p[1]->r)[c] * 255 - c0;
+		double const c2 = (&p[2]->r)[c] * 255 - c0;
+		double const dx = (c1 * y2 - c2 * y1) / d;
+		double const dy = (c2 * x1 - c1 * x2) / d;
+
+		t->plane[c][0] = dx;
+		t->plane[c][1] = dy;
+		t->plane[c][2] = c0 - dx * x0 - dy * y0;
+	}
+
+	/* Pixel centers are at + 8 */
+	int64_t minx = fx[0], maxx = fx[0], miny = fy[0], maxy = fy[0];
+	for (int i = 1; i < 3; i++) {
+		minx = fx[i] < minx ? fx[i] : minx;
+		maxx = fx[i] > maxx ? fx[i] : maxx;
+		miny = fy[i] < miny ? fy[i] : miny;
+		maxy = fy[i] > maxy ? fy[i] : maxy;
+	}
+	t->x0 = (minx - 8) >> 4;
+	t->y0 = (miny - 8) >> 4;
+	t->x1 = ((maxx - 8) >> 4) + 1;
+	t->y1 = ((maxy - 8) >> 4) + 1;
+	t->x0 = t->x0 < 0 ? 0 : t->x0;
+	t->y0 = t->y0 < 0 ? 0 : t->y0;
+	t->x1 = t->x1 > (int32_t) s->width ? (int32_t) s->width : t->x1;
+	t->y1 = t->y1 > (int32_t) s->height ? (int32_t) s->height : t->y1;
+	if (t->x0 >= t->x1 || t->y0 >= t->y1)
+		return -1;
+
+	t->s = s;
+	t->tiles_x = (t->x1 - t->x0 + TILE_SIZE - 1) / TILE_SIZE;
+	t->tiles = t->tiles_x * ((t->y1 - t->y0 + TILE_SIZE - 1) / TILE_SIZE);
+	atomic_init(&t->next_tile, 0);
+
+	return 0;
+}
+
+static int64_t edge_at(const struct setup *t, int i, int32_t x, int32_t y)
+{
+	return t->A[i] * (x * 16 + 8) + t->B[i] * (y * 16 + 8) + t->C[i];
+}
+
+static double plane_at(const struct setup *t, int c, double x, double y)
+{
+	return t->plane[c][0] * x + t->plane[c][1] * y + t->plane[c][2];
+}
+
+/* Round and clamp to 0..255. A macro rather than a function, since vector
+ * arguments would have a different ABI in each clone. */
+#define TO_CHANNEL(out, c) do { \
+	v8i over; \
+	out = __builtin_convertvector((c) + 0.5f, v8i); \
+	out &= ~(out >> 31); \
+	over = out - 255; \
+	out -= over & ~(over >> 31); \
+} while (0)
+
+RASTER_CLONES
+static void raster_span(uint32_t * __restrict dst, int32_t n,
+                        const struct raster_row * __restrict row)
+{
+	v8i const lane = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	v8f const lanef = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	v8i e0 = row->e[0] + lane * row->step[0];
+	v8i e1 = row->e[1] + lane * row->step[1];
+	v8i e2 = row->e[2] + lane * row->step[2];
+	v8f r = row->c[0] + lanef * row->dc[0];
+	v8f g = row->c[1] + lanef * row->dc[1];
+	v8f b = row->c[2] + lanef * row->dc[2];
+
+	for (int32_t x = 0; x < n; x += 8) {
+		v8i const inside = (e0 | e1 | e2) >= 0;
+		v8i cr, cg, cb;
+
+		TO_CHANNEL(cr, r);
+		TO_CHANNEL(cg, g);
+		TO_CHANNEL(cb, b);
+
+		v8i const px = cr << 16 | cg << 8 | cb;
+		int32_t const m = n - x < 8 ? n - x : 8;
+		int full = m == 8;
+
+		for (int i = 0; i < 8; i++)
+			full &= inside[i] != 0;
+
+		/* Only ever write covered pixels, whole vectors when we can */
+		if (full) {
+			memcpy(dst + x, &px, sizeof(px));
+		} else {
+			for (int i = 0; i < m; i++)
+				if (inside[i])
+					dst[x + i] = px[i];
+		}
+
+		e0 += row->step[0] * 8;
+		e1 += row->step[1] * 8;
+		e2 += row->step[2] * 8;
+		r += row->dc[0] * 8;
+		g += row->dc[1] * 8;
+		b += row->dc[2] * 8;
+	}
+}
+
+static void raster_tile(const struct setup * __restrict t, int tile)
+{
+	int32_t const x0 = t->x0 + tile % t->tiles_x * TILE_SIZE;
+	int32_t const y0 = t->y0 + tile / t->tiles_x * TILE_SIZE;
+	int32_t const x1 = x0 + TILE_SIZE < t->x1 ? x0 + TILE_SIZE : t->x1;
+	int32_t const y1 = y0 + TILE_SIZE < t->y1 ? y0 + TILE_SIZE : t->y1;
+	struct raster_row row;
+	int32_t ystep[3];
+
+	/* Edges are linear, so the corners tell whether the tile is all
+	 * outside an edge, all inside, or needs testing per pixel. Edges the
+	 * whole tile is inside of are left out. */
+	for (int i = 0; i < 3; i++) {
+		int64_t const corners[4] = {
+			edge_at(t, i, x0, y0), edge_at(t, i, x1 - 1, y0),
+			edge_at(t, i, x0, y1 - 1), edge_at(t, i, x1 - 1, y1 - 1)
+		};
+		int64_t lo = corners[0], hi = corners[0];
+
+		for (int c = 1; c < 4; c++) {
+			lo = corners[c] < lo ? corners[c] : lo;
+			hi = corners[c] > hi ? corners[c] : hi;
+		}
+
+		if (hi < 0)
+			return;
+
+		if (lo >= 0) {
+			row.e[i] = row.step[i] = ystep[i] = 0;
+		} else {
+			row.e[i] = corners[0];
+			row.step[i] = t->A[i] * 16;
+			ystep[i] = t->B[i] * 16;
+		}
+	}
+
+	for (int c = 0; c < 3; c++)
+		row.dc[c] = t->plane[c][0];
+
+	for (int32_t y = y0; y < y1; y++) {
+		uint32_t * __restrict dst = (uint32_t *)
+			(t->s->map + (uint64_t) y * t->s->pitch) + x0;
+
+		for (int c = 0; c < 3; c++)
+			row.c[c] = plane_at(t, c, x0 + 0.5, y + 0.5);
+
+		raster_span(dst, x1 - x0, &row);
+
+		for (int i = 0; i < 3; i++)
+			row.e[i] += ystep[i];
+	}
+}
+
+/* Every draw thread takes tiles until there are none left */
+static void raster_job(void *data, int index)
+{
+	struct setup * __restrict t = data;
+	int tile;
+
+	(void) index;
+	while ((tile = atomic_fetch_add(&t->next_tile, 1)) < t->tiles)
+		raster_tile(t, tile);
+}
+
+void dumb_triangle(struct dumb_surface *s, const struct dumb_vertex v[3])
+{
+	struct setup t;
+	int n = dumb_draw_threads();
+
+	if (triangle_setup(&t, s, v))
+		return;
+
+	if (s->damage) {
+		struct dumb_rect const r = {
+			t.x0, t.y0, t.x1 - t.x0, t.y1 - t.y0
+		};
+
+		dumb_damage_add(s->damage, &r);
+	}
+
+	if (n > t.tiles)
+		n = t.tiles;
+
+	dumb_draw_run(raster_job, &t, n);
+}
+
+void dumb_triangle_reference(struct dumb_surface *s,
+                             const struct dumb_vertex v[3])
+{
+	struct setup t;
+
+	if (triangle_setup(&t, s, v))
+		return;
+
+	for (int32_t y = t.y0; y < t.y1; y++) {
+		uint32_t * __restrict dst = (uint32_t *)
+			(s->map + (uint64_t) y * s->pitch);
+
+		for (int32_t x = t.x0; x < t.x1; x++) {
+			uint32_t px = 0;
+
+			if (edge_at(&t, 0, x, y) < 0 || edge_at(&t, 1, x, y) < 0 ||
+			    edge_at(&t, 2, x, y) < 0)
+				continue;
+
+			for (int c = 0; c < 3; c++) {
+				long const value =
+					lround(plane_at(&t, c, x + 0.5, y + 0.5));
+
+				px = px << 8 |
+				     (value < 0 ? 0 : value > 255 ? 255 : value);
+			}
+			dst[x] = px;
+		}
+	}
+}
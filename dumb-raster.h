@@ -0,0 +1,26 @@
+#ifndef DUMB_RASTER_H
+#define DUMB_RASTER_H
+
+#include "dumb-draw.h"
+
+/* What egl-color.vert gets : a position in normalized device coordinates
+ * and a color, interpolated across the triangle just like the varying. */
+struct dumb_vertex {
+	float x, y;
+	float r, g, b;
+};
+
+/* Half-space rasterizer for one smooth shaded triangle covering the
+ * surface as the viewport. The surface is cut into tiles the draw threads
+ * pick from, and each tile row is shaded eight pixels at a time.
+ *
+ * There's no clipping : vertices must stay within a few times the
+ * viewport, which is all egl-color ever needs. */
+void dumb_triangle(struct dumb_surface *s, const struct dumb_vertex v[3]);
+
+/* The same triangle, one pixel at a time with doubles, to check the fast
+ * path against. */
+void dumb_triangle_reference(struct dumb_surface *s,
+                             const struct dumb_vertex v[3]);
+
+#endif
@@ -0,0 +1,488 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+
+#include "latency.h"
+
+/* Many egl-color style render checks in one process : EGL, the context
+ * and every shader pair are set up once, instead of once per check.
+ *
+ * The manifest has a scene per line, # starts a comment :
+ *
+ *   name vert=egl-color.vert frag=egl-color.frag geometry=triangle
+ *        size=256x256 golden=triangle.png tolerance=2 out=triangle-out.png
+ *
+ * geometry is triangle, quad, or a file with one vertex per line as
+ * x y z r g b a, three per triangle. A scene passes when every channel of
+ * every pixel is within tolerance of the golden PNG, or when it just
+ * renders if there is no golden. out= saves what got rendered. With
+ * update, goldens are written instead of compared.
+ */
+
+int writeImage(char* filename, int width, int height, void *buffer, char* title);
+EGLDisplay OffscreenDisplay(int use_device, int device, EGLConfig *config);
+GLuint LoadShader(const char *name, GLenum type);
+
+#define MAX_SCENES 4096
+#define MAX_PROGRAMS 64
+#define MAX_TARGETS 8
+
+struct scene {
+	char name[64];
+	char vert[256], frag[256];
+	char geometry[256];
+	char golden[256], out[256];
+	int width, height;
+	int tolerance;
+};
+
+struct cached_program {
+	char vert[256], frag[256];
+	GLuint program;
+};
+
+/* Scenes of the same size share a framebuffer */
+struct render_target {
+	int width, height;
+	GLuint texture, fbo;
+};
+
+struct geometry {
+	GLfloat *vertices;
+	int count;
+};
+
+extern EGLDisplay display;
+static struct cached_program programs[MAX_PROGRAMS];
+static int program_count;
+static struct render_target targets[MAX_TARGETS];
+static int target_count;
+
+static void RenderInit(void)
+{
+	EGLConfig config;
+
+	assert((display = OffscreenDisplay(0, -1, &config)) != EGL_NO_DISPLAY);
+
+	EGLContext context;
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	assert((context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs)) != EGL_NO_CONTEXT);
+	assert(eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_TRUE);
+}
+
+/* Compiled and linked the first time a pair is asked for, 0 on error */
+static GLuint get_program(const char *vert, const char *frag)
+{
+	GLuint vertexShader, fragmentShader, program;
+	GLint linked;
+
+	for (int p = 0; p < program_count; p++)
+		if (strcmp(programs[p].vert, vert) == 0 &&
+		    strcmp(programs[p].frag, frag) == 0)
+			return programs[p].program;
+
+	if (program_count == MAX_PROGRAMS)
+		return 0;
+
+	vertexShader = LoadShader(vert, GL_VERTEX_SHADER);
+	fragmentShader = LoadShader(frag, GL_FRAGMENT_SHADER);
+	if (!vertexShader || !fragmentShader) {
+		if (vertexShader)
+			glDeleteShader(vertexShader);
+		if (fragmentShader)
+			glDeleteShader(fragmentShader);
+		return 0;
+	}
+
+	program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		fprintf(stderr, "Error linking %s and %s\n", vert, frag);
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	strcpy(programs[program_count].vert, vert);
+	strcpy(programs[program_count].frag, frag);
+	programs[program_count].program = program;
+	program_count++;
+
+	return program;
+}
+
+/* Bound, and cleared to transparent black */
+static struct render_target *get_target(int width, int height)
+{
+	struct render_target *target = NULL;
+
+	for (int t = 0; t < target_count; t++)
+		if (targets[t].width == width && targets[t].height == height)
+			target = &targets[t];
+
+	if (!target) {
+		// Full : the oldest size goes.
+		if (target_count == MAX_TARGETS) {
+			glDeleteFramebuffers(1, &targets[0].fbo);
+			glDeleteTextures(1, &targets[0].texture);
+			memmove(&targets[0], &targets[1],
+					(MAX_TARGETS - 1) * sizeof(targets[0]));
+			target_count--;
+		}
+		target = &targets[target_count];
+		target->width = width;
+		target->height = height;
+
+		glGenTextures(1, &target->texture);
+		glBindTexture(GL_TEXTURE_2D, target->texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenFramebuffers(1, &target->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_TEXTURE_2D, target->texture, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			glDeleteFramebuffers(1, &target->fbo);
+			glDeleteTextures(1, &target->texture);
+			return NULL;
+		}
+		target_count++;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+	glViewport(0, 0, width, height);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	return target;
+}
+
+/* The egl-color triangle, and a quad covering the whole target */
+static GLfloat triangle[] = {
+	-1, -1, 0, 1, 0, 0, 1,
+	-1, 1, 0, 0, 1, 0, 1,
+	1, 1, 0, 0, 0, 1, 1,
+};
+
+static GLfloat quad[] = {
+	-1, -1, 0, 1, 0, 0, 1,
+	1, -1, 0, 0, 1, 0, 1,
+	-1, 1, 0, 0, 0, 1, 1,
+	-1, 1, 0, 0, 0, 1, 1,
+	1, -1, 0, 0, 1, 0, 1,
+	1, 1, 0, 1, 1, 1, 1,
+};
+
+static int get_geometry(const char *name, struct geometry *geometry)
+{
+	FILE *f;
+	GLfloat v[7];
+	int allocated = 0;
+
+	geometry->vertices = NULL;
+	geometry->count = 0;
+
+	if (strcmp(name, "triangle") == 0) {
+		geometry->vertices = triangle;
+		geometry->count = 3;
+		return 0;
+	}
+	if (strcmp(name, "quad") == 0) {
+		geometry->vertices = quad;
+		geometry->count = 6;
+		return 0;
+	}
+
+	if ((f = fopen(name, "r")) == NULL) {
+		fprintf(stderr, "Could not open %s : %s\n", name, strerror(errno));
+		return -1;
+	}
+	while (fscanf(f, "%f %f %f %f %f %f %f",
+			&v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6]) == 7) {
+		if (geometry->count == allocated) {
+			allocated = allocated ? allocated * 2 : 64;
+			geometry->vertices = realloc(geometry->vertices,
+					allocated * sizeof(v));
+			assert(geometry->vertices);
+		}
+		memcpy(geometry->vertices + geometry->count * 7, v, sizeof(v));
+		geometry->count++;
+	}
+	fclose(f);
+
+	return geometry->count ? 0 : -1;
+}
+
+static void put_geometry(struct geometry *geometry)
+{
+	if (geometry->vertices != triangle && geometry->vertices != quad)
+		free(geometry->vertices);
+}
+
+static void Draw(GLuint program, struct geometry *geometry)
+{
+	GLint position = glGetAttribLocation(program, "positionIn");
+	GLint colorIn = glGetAttribLocation(program, "colorIn");
+
+	glUseProgram(program);
+	if (position >= 0) {
+		glEnableVertexAttribArray(position);
+		glVertexAttribPointer(position, 3, GL_FLOAT, 0,
+				7 * sizeof(GLfloat), geometry->vertices);
+	}
+	if (colorIn >= 0) {
+		glEnableVertexAttribArray(colorIn);
+		glVertexAttribPointer(colorIn, 4, GL_FLOAT, 0,
+				7 * sizeof(GLfloat), geometry->vertices + 3);
+	}
+	glDrawArrays(GL_TRIANGLES, 0, geometry->count);
+	if (position >= 0)
+		glDisableVertexAttribArray(position);
+	if (colorIn >= 0)
+		glDisableVertexAttribArray(colorIn);
+}
+
+/* RGBA rows in the order writeImage saved them, NULL when there's no such
+ * file or it's another size */
+static GLubyte *readImage(const char *filename, int width, int height)
+{
+	png_image image;
+	GLubyte *buffer;
+
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&image, filename))
+		return NULL;
+
+	if ((int) image.width != width || (int) image.height != height) {
+		fprintf(stderr, "%s is %ux%u, not %dx%d\n", filename,
+				image.width, image.height, width, height);
+		png_image_free(&image);
+		return NULL;
+	}
+
+	image.format = PNG_FORMAT_RGBA;
+	buffer = malloc(PNG_IMAGE_SIZE(image));
+	if (!buffer || !png_image_finish_read(&image, NULL, buffer, 0, NULL)) {
+		free(buffer);
+		png_image_free(&image);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/* Pixels with a channel further than tolerance from the golden one */
+static long compare(const GLubyte *result, const GLubyte *golden,
+		int width, int height, int tolerance, int *max_diff)
+{
+	long bad = 0;
+
+	*max_diff = 0;
+	for (long p = 0; p < (long) width * height; p++) {
+		int pixel_diff = 0;
+
+		for (int c = 0; c < 4; c++) {
+			int diff = abs(result[p * 4 + c] - golden[p * 4 + c]);
+
+			if (diff > pixel_diff)
+				pixel_diff = diff;
+		}
+		if (pixel_diff > *max_diff)
+			*max_diff = pixel_diff;
+		if (pixel_diff > tolerance)
+			bad++;
+	}
+
+	return bad;
+}
+
+static int parse_scene(char *line, struct scene *scene)
+{
+	char *token, *save;
+
+	memset(scene, 0, sizeof(*scene));
+	strcpy(scene->vert, "egl-color.vert");
+	strcpy(scene->frag, "egl-color.frag");
+	strcpy(scene->geometry, "triangle");
+	scene->width = scene->height = 256;
+
+	if ((token = strchr(line, '#')) != NULL)
+		*token = '\0';
+
+	token = strtok_r(line, " \t\n", &save);
+	if (!token)
+		return 1;
+	snprintf(scene->name, sizeof(scene->name), "%s", token);
+
+	while ((token = strtok_r(NULL, " \t\n", &save)) != NULL) {
+		if (strncmp(token, "vert=", 5) == 0)
+			snprintf(scene->vert, sizeof(scene->vert), "%s", token + 5);
+		else if (strncmp(token, "frag=", 5) == 0)
+			snprintf(scene->frag, sizeof(scene->frag), "%s", token + 5);
+		else if (strncmp(token, "geometry=", 9) == 0)
+			snprintf(scene->geometry, sizeof(scene->geometry), "%s", token + 9);
+		else if (strncmp(token, "golden=", 7) == 0)
+			snprintf(scene->golden, sizeof(scene->golden), "%s", token + 7);
+		else if (strncmp(token, "out=", 4) == 0)
+			snprintf(scene->out, sizeof(scene->out), "%s", token + 4);
+		else if (strncmp(token, "tolerance=", 10) == 0)
+			scene->tolerance = atoi(token + 10);
+		else if (strncmp(token, "size=", 5) != 0 ||
+			 sscanf(token + 5, "%dx%d", &scene->width, &scene->height) != 2) {
+			fprintf(stderr, "%s : unknown %s\n", scene->name, token);
+			return -1;
+		}
+	}
+
+	if (scene->width <= 0 || scene->height <= 0 ||
+	    scene->width > 16384 || scene->height > 16384) {
+		fprintf(stderr, "%s : bad size %dx%d\n", scene->name,
+				scene->width, scene->height);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* 0 for a pass */
+static int run_scene(struct scene *scene, int update)
+{
+	struct geometry geometry;
+	struct render_target *target;
+	GLubyte *result, *golden = NULL;
+	uint64_t t, setup_ns, draw_ns, check_ns;
+	const char *verdict = "pass";
+	char detail[300] = "";
+	int ret = 0;
+
+	t = now_ns();
+	GLuint const program = get_program(scene->vert, scene->frag);
+	target = get_target(scene->width, scene->height);
+	if (!program || !target || get_geometry(scene->geometry, &geometry)) {
+		printf("%-24s error : could not set up\n", scene->name);
+		return -1;
+	}
+	setup_ns = now_ns() - t;
+
+	result = malloc((size_t) scene->width * scene->height * 4);
+	assert(result);
+
+	t = now_ns();
+	Draw(program, &geometry);
+	glReadPixels(0, 0, scene->width, scene->height, GL_RGBA,
+			GL_UNSIGNED_BYTE, result);
+	draw_ns = now_ns() - t;
+	put_geometry(&geometry);
+
+	t = now_ns();
+	if (glGetError() != GL_NO_ERROR) {
+		verdict = "FAIL";
+		snprintf(detail, sizeof(detail), "GL error");
+		ret = -1;
+	} else if (scene->golden[0] && update) {
+		verdict = "new";
+		if (writeImage(scene->golden, scene->width, scene->height,
+					result, scene->name))
+			ret = -1;
+	} else if (scene->golden[0]) {
+		golden = readImage(scene->golden, scene->width, scene->height);
+		if (!golden) {
+			verdict = "FAIL";
+			snprintf(detail, sizeof(detail), "no usable %s", scene->golden);
+			ret = -1;
+		} else {
+			int max_diff;
+			long const bad = compare(result, golden, scene->width,
+					scene->height, scene->tolerance, &max_diff);
+
+			if (bad) {
+				verdict = "FAIL";
+				ret = -1;
+			}
+			snprintf(detail, sizeof(detail), "%ld pixels off, max diff %d",
+					bad, max_diff);
+		}
+	}
+	if (scene->out[0])
+		writeImage(scene->out, scene->width, scene->height, result,
+				scene->name);
+	check_ns = now_ns() - t;
+
+	printf("%-24s %4s %9.3f %9.3f %9.3f  %s\n", scene->name, verdict,
+			setup_ns / 1e6, draw_ns / 1e6, check_ns / 1e6, detail);
+
+	free(golden);
+	free(result);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *manifest = NULL;
+	int update = 0;
+
+	for (int arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "update") == 0)
+			update = 1;
+		else
+			manifest = argv[arg];
+	}
+	if (!manifest) {
+		fprintf(stderr, "usage: %s [update] manifest\n", argv[0]);
+		return 2;
+	}
+
+	FILE *f = fopen(manifest, "r");
+	if (!f) {
+		fprintf(stderr, "Could not open %s : %s\n", manifest, strerror(errno));
+		return 2;
+	}
+
+	uint64_t t = now_ns();
+	RenderInit();
+	printf("EGL and context set up once in %.3f ms\n", (now_ns() - t) / 1e6);
+
+	printf("%-24s %4s %9s %9s %9s\n", "scene", "", "setup ms", "draw ms",
+			"check ms");
+
+	char line[2048];
+	int scenes = 0, passed = 0, failed = 0;
+
+	t = now_ns();
+	while (fgets(line, sizeof(line), f) && scenes < MAX_SCENES) {
+		struct scene scene;
+		int parsed = parse_scene(line, &scene);
+
+		if (parsed > 0)
+			continue;
+		scenes++;
+		if (parsed == 0 && run_scene(&scene, update) == 0)
+			passed++;
+		else
+			failed++;
+	}
+	fclose(f);
+
+	printf("%d scenes, %d passed, %d failed in %.3f ms, %d programs, %d targets\n",
+			scenes, passed, failed, (now_ns() - t) / 1e6, program_count,
+			target_count);
+
+	return failed ? 1 : 0;
+}
@@ -5,18 +5,30 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <gbm.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <drm_fourcc.h>
 
+extern __thread GLuint program;
 extern EGLDisplay display;
-extern EGLSurface surface;
+extern __thread EGLSurface surface;
 
 void InitGLES(int width, int height);
 void Render(void);
@@ -26,55 +38,1710 @@ struct kms {
    drmModeEncoder *encoder;
    drmModeModeInfo mode;
    uint32_t fb_id;
+   int crtc_index;
 };
 
+/*
+ * drmModeGetConnector makes the kernel probe the connector, which usually
+ * means reading the EDID over DDC and can take hundreds of milliseconds per
+ * connector.  With fast set we only ask for the state the kernel already
+ * has (drmModeGetConnectorCurrent), and fall back to a real probe only for
+ * connectors that were never probed before.
+ */
+static drmModeConnector *
+get_connector(int fd, uint32_t connector_id, int fast)
+{
+   drmModeConnector *connector = NULL;
+
+   if (fast)
+      connector = drmModeGetConnectorCurrent(fd, connector_id);
+   if (connector == NULL ||
+       (connector->connection != DRM_MODE_DISCONNECTED &&
+        connector->count_modes == 0)) {
+      drmModeFreeConnector(connector);
+      connector = drmModeGetConnector(fd, connector_id);
+   }
+
+   return connector;
+}
+
 static EGLBoolean
-setup_kms(int fd, struct kms *kms)
+setup_kms(int fd, struct kms *kms, int fast)
+{
+   drmModeRes *resources = NULL;
+   drmModeConnector *connector = NULL;
+   drmModeEncoder *encoder = NULL;
+   int i;
+
+   resources = drmModeGetResources(fd);
+   if (!resources) {
+      fprintf(stderr, "drmModeGetResources failed\n");
+      return EGL_FALSE;
+   }
+
+   for (i = 0; i < resources->count_connectors; i++) {
+      connector = get_connector(fd, resources->connectors[i], fast);
+      if (connector == NULL)
+         continue;
+
+      if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+         break;
+
+      drmModeFreeConnector(connector);
+   }
+
+   if (i == resources->count_connectors) {
+      fprintf(stderr, "No currently active connector found.\n");
+      drmModeFreeResources(resources);
+      return EGL_FALSE;
+   }
+
+   encoder = drmModeGetEncoder(fd, connector->encoder_id);
+   if (encoder == NULL) {
+      fprintf(stderr, "No encoder for connector %u.\n", connector->connector_id);
+      drmModeFreeConnector(connector);
+      drmModeFreeResources(resources);
+      return EGL_FALSE;
+   }
+
+   kms->crtc_index = -1;
+   for (i = 0; i < resources->count_crtcs; i++) {
+      if (resources->crtcs[i] == encoder->crtc_id) {
+         kms->crtc_index = i;
+         break;
+      }
+   }
+
+   kms->connector = connector;
+   kms->encoder = encoder;
+   kms->mode = connector->modes[0];
+
+   drmModeFreeResources(resources);
+
+   return EGL_TRUE;
+}
+
+/*
+ * The connector/CRTC/mode picked by setup_kms is cached on disk, keyed by
+ * the device number of the DRM node, so a warm start only has to check
+ * that the cached connector is still connected and driven the same way.
+ */
+
+#define KMS_CACHE_MAGIC 0x314b4d53 /* "SMK1" */
+
+struct kms_cache {
+   uint32_t magic;
+   uint32_t connector_id;
+   uint32_t encoder_id;
+   uint32_t crtc_id;
+   int crtc_index;
+   drmModeModeInfo mode;
+};
+
+static void
+kms_cache_path(int fd, char *path, size_t size)
+{
+   const char *dir = getenv("XDG_CACHE_HOME");
+   struct stat st;
+
+   if (fstat(fd, &st))
+      st.st_rdev = 0;
+
+   snprintf(path, size, "%s/kms-%u-%u.cache", dir ? dir : "/var/tmp",
+            major(st.st_rdev), minor(st.st_rdev));
+}
+
+static EGLBoolean
+setup_kms_cached(int fd, struct kms *kms, const char *path)
+{
+   drmModeConnector *connector;
+   drmModeEncoder *encoder;
+   struct kms_cache cache;
+   int i, found;
+   FILE *f;
+
+   f = fopen(path, "rb");
+   if (f == NULL)
+      return EGL_FALSE;
+   found = fread(&cache, sizeof cache, 1, f) == 1 && cache.magic == KMS_CACHE_MAGIC;
+   fclose(f);
+   if (!found)
+      return EGL_FALSE;
+
+   connector = drmModeGetConnectorCurrent(fd, cache.connector_id);
+   if (connector == NULL)
+      return EGL_FALSE;
+
+   if (connector->connection != DRM_MODE_CONNECTED ||
+       connector->encoder_id != cache.encoder_id)
+      goto free_connector;
+
+   /* the kernel may not have a mode list yet, then trust the cache */
+   found = connector->count_modes == 0;
+   for (i = 0; i < connector->count_modes && !found; i++)
+      found = memcmp(&connector->modes[i], &cache.mode, sizeof cache.mode) == 0;
+   if (!found)
+      goto free_connector;
+
+   encoder = drmModeGetEncoder(fd, cache.encoder_id);
+   if (encoder == NULL)
+      goto free_connector;
+   if (encoder->crtc_id != cache.crtc_id) {
+      drmModeFreeEncoder(encoder);
+      goto free_connector;
+   }
+
+   kms->connector = connector;
+   kms->encoder = encoder;
+   kms->mode = cache.mode;
+   kms->crtc_index = cache.crtc_index;
+
+   return EGL_TRUE;
+
+free_connector:
+   drmModeFreeConnector(connector);
+   return EGL_FALSE;
+}
+
+static void
+kms_cache_save(struct kms *kms, const char *path)
+{
+   struct kms_cache cache = {
+      .magic = KMS_CACHE_MAGIC,
+      .connector_id = kms->connector->connector_id,
+      .encoder_id = kms->encoder->encoder_id,
+      .crtc_id = kms->encoder->crtc_id,
+      .crtc_index = kms->crtc_index,
+      .mode = kms->mode,
+   };
+   FILE *f;
+
+   f = fopen(path, "wb");
+   if (f == NULL || fwrite(&cache, sizeof cache, 1, f) != 1)
+      fprintf(stderr, "failed to write kms cache %s\n", path);
+   if (f)
+      fclose(f);
+}
+
+/*
+ * Multi-layer mode: a background, a moving sprite and a cursor-like layer
+ * are each rendered into their own GBM surface and put on separate hardware
+ * planes, so moving the sprite or the cursor costs no GPU work at all.
+ * Only when the driver rejects that configuration in a TEST_ONLY commit do
+ * we fall back to compositing every layer on the GPU into one buffer shown
+ * on the primary plane, like a compositor without overlay support would.
+ */
+
+static PFNEGLCREATEIMAGEKHRPROC create_image;
+static PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
+
+struct drm_fb {
+   struct gbm_bo *bo;
+   uint32_t fb_id;
+   EGLImageKHR image;
+   GLuint texture;
+};
+
+static void
+drm_fb_destroy_callback(struct gbm_bo *bo, void *data)
+{
+   int fd = gbm_device_get_fd(gbm_bo_get_device(bo));
+   struct drm_fb *fb = data;
+
+   if (fb->texture)
+      glDeleteTextures(1, &fb->texture);
+   if (fb->image != EGL_NO_IMAGE_KHR)
+      destroy_image(display, fb->image);
+   if (fb->fb_id)
+      drmModeRmFB(fd, fb->fb_id);
+
+   free(fb);
+}
+
+static struct drm_fb *
+drm_fb_get_from_bo(struct gbm_bo *bo)
+{
+   int fd = gbm_device_get_fd(gbm_bo_get_device(bo));
+   struct drm_fb *fb = gbm_bo_get_user_data(bo);
+   uint32_t handles[4] = { 0 }, strides[4] = { 0 }, offsets[4] = { 0 };
+   int ret;
+
+   if (fb)
+      return fb;
+
+   fb = calloc(1, sizeof *fb);
+   fb->bo = bo;
+   fb->image = EGL_NO_IMAGE_KHR;
+
+   handles[0] = gbm_bo_get_handle(bo).u32;
+   strides[0] = gbm_bo_get_stride(bo);
+   ret = drmModeAddFB2(fd, gbm_bo_get_width(bo), gbm_bo_get_height(bo),
+                       gbm_bo_get_format(bo), handles, strides, offsets,
+                       &fb->fb_id, 0);
+   if (ret) {
+      fprintf(stderr, "failed to create fb: %m\n");
+      free(fb);
+      return NULL;
+   }
+
+   gbm_bo_set_user_data(bo, fb, drm_fb_destroy_callback);
+
+   return fb;
+}
+
+/* Lazily wrap a layer buffer in a texture so the composition pass can
+ * sample it directly, without any copy. */
+static GLuint
+drm_fb_get_texture(struct drm_fb *fb)
+{
+   if (fb->texture)
+      return fb->texture;
+
+   fb->image = create_image(display, EGL_NO_CONTEXT, EGL_NATIVE_PIXMAP_KHR,
+                            (EGLClientBuffer)fb->bo, NULL);
+   if (fb->image == EGL_NO_IMAGE_KHR) {
+      fprintf(stderr, "failed to create EGLImage for layer buffer\n");
+      return 0;
+   }
+
+   glGenTextures(1, &fb->texture);
+   glBindTexture(GL_TEXTURE_2D, fb->texture);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+   image_target_texture_2d(GL_TEXTURE_2D, fb->image);
+
+   return fb->texture;
+}
+
+static uint32_t
+get_prop_id(int fd, uint32_t obj_id, uint32_t obj_type, const char *name,
+            uint64_t *value)
+{
+   drmModeObjectProperties *props;
+   uint32_t id = 0;
+   uint32_t i;
+
+   props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+   if (!props)
+      return 0;
+
+   for (i = 0; i < props->count_props && !id; i++) {
+      drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+
+      if (!prop)
+         continue;
+
+      if (strcmp(prop->name, name) == 0) {
+         id = prop->prop_id;
+         if (value)
+            *value = props->prop_values[i];
+      }
+
+      drmModeFreeProperty(prop);
+   }
+
+   drmModeFreeObjectProperties(props);
+
+   return id;
+}
+
+struct plane_props {
+   uint32_t fb_id, crtc_id;
+   uint32_t src_x, src_y, src_w, src_h;
+   uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+};
+
+static int
+get_plane_props(int fd, uint32_t plane_id, struct plane_props *p)
+{
+#define PLANE_PROP(field, name) \
+   if (!(p->field = get_prop_id(fd, plane_id, DRM_MODE_OBJECT_PLANE, name, NULL))) \
+      return -1;
+   PLANE_PROP(fb_id, "FB_ID")
+   PLANE_PROP(crtc_id, "CRTC_ID")
+   PLANE_PROP(src_x, "SRC_X")
+   PLANE_PROP(src_y, "SRC_Y")
+   PLANE_PROP(src_w, "SRC_W")
+   PLANE_PROP(src_h, "SRC_H")
+   PLANE_PROP(crtc_x, "CRTC_X")
+   PLANE_PROP(crtc_y, "CRTC_Y")
+   PLANE_PROP(crtc_w, "CRTC_W")
+   PLANE_PROP(crtc_h, "CRTC_H")
+#undef PLANE_PROP
+   return 0;
+}
+
+enum layer_id {
+   LAYER_BACKGROUND,
+   LAYER_SPRITE,
+   LAYER_CURSOR,
+   NUM_LAYERS
+};
+
+struct layer {
+   const char *name;
+   uint64_t plane_type;
+   uint32_t width, height;
+   int x, y, dx, dy;
+   GLfloat color[4];
+
+   struct gbm_surface *gs;
+   EGLSurface surface;
+   struct gbm_bo *bo;
+
+   uint32_t plane_id;
+   struct plane_props props;
+};
+
+static EGLConfig
+choose_config(uint32_t format)
+{
+   static const EGLint config_attribs[] = {
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+      EGL_NONE
+   };
+   EGLConfig configs[64], config = NULL;
+   EGLint i, n;
+
+   if (!eglChooseConfig(display, config_attribs, configs, 64, &n))
+      return NULL;
+
+   /* mesa only accepts GBM surfaces whose format matches the visual */
+   for (i = 0; i < n && !config; i++) {
+      EGLint visual;
+
+      if (eglGetConfigAttrib(display, configs[i], EGL_NATIVE_VISUAL_ID, &visual) &&
+          (uint32_t)visual == format)
+         config = configs[i];
+   }
+
+   return config;
+}
+
+static int
+assign_planes(int fd, struct kms *kms, struct layer *layers)
+{
+   drmModePlaneRes *plane_res;
+   uint32_t i, f;
+   int l, pass, missing = 0;
+
+   plane_res = drmModeGetPlaneResources(fd);
+   if (!plane_res) {
+      fprintf(stderr, "drmModeGetPlaneResources failed: %m\n");
+      return -1;
+   }
+
+   /* The first pass only hands out planes of the type each layer asks
+    * for, the second one lets layers without a match (typically the
+    * cursor layer on hardware without a cursor plane) take any overlay. */
+   for (pass = 0; pass < 2; pass++) {
+      for (i = 0; i < plane_res->count_planes; i++) {
+         drmModePlane *plane = drmModeGetPlane(fd, plane_res->planes[i]);
+         uint64_t type = DRM_PLANE_TYPE_OVERLAY;
+         int has_format = 0, taken = 0;
+
+         if (!plane)
+            continue;
+
+         if (!(plane->possible_crtcs & (1 << kms->crtc_index)))
+            goto next;
+
+         for (l = 0; l < NUM_LAYERS; l++)
+            taken |= layers[l].plane_id == plane->plane_id;
+         if (taken)
+            goto next;
+
+         for (f = 0; f < plane->count_formats; f++)
+            has_format |= plane->formats[f] == DRM_FORMAT_ARGB8888;
+         if (!has_format)
+            goto next;
+
+         get_prop_id(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type);
+
+         for (l = 0; l < NUM_LAYERS; l++) {
+            if (layers[l].plane_id)
+               continue;
+
+            if (type == layers[l].plane_type ||
+                (pass == 1 && l != LAYER_BACKGROUND &&
+                 type == DRM_PLANE_TYPE_OVERLAY)) {
+               if (get_plane_props(fd, plane->plane_id, &layers[l].props))
+                  break;
+               layers[l].plane_id = plane->plane_id;
+               break;
+            }
+         }
+next:
+         drmModeFreePlane(plane);
+      }
+   }
+
+   drmModeFreePlaneResources(plane_res);
+
+   for (l = 0; l < NUM_LAYERS; l++) {
+      if (layers[l].plane_id)
+         printf("layer %-10s -> plane %u\n", layers[l].name, layers[l].plane_id);
+      else
+         printf("layer %-10s -> no plane\n", layers[l].name);
+      missing |= !layers[l].plane_id;
+   }
+
+   return missing;
+}
+
+static void
+add_plane(drmModeAtomicReq *req, struct layer *layer, uint32_t crtc_id,
+          uint32_t fb_id)
+{
+   uint32_t id = layer->plane_id;
+
+   drmModeAtomicAddProperty(req, id, layer->props.fb_id, fb_id);
+   drmModeAtomicAddProperty(req, id, layer->props.crtc_id, fb_id ? crtc_id : 0);
+   drmModeAtomicAddProperty(req, id, layer->props.src_x, 0);
+   drmModeAtomicAddProperty(req, id, layer->props.src_y, 0);
+   drmModeAtomicAddProperty(req, id, layer->props.src_w, (uint64_t)layer->width << 16);
+   drmModeAtomicAddProperty(req, id, layer->props.src_h, (uint64_t)layer->height << 16);
+   drmModeAtomicAddProperty(req, id, layer->props.crtc_x, layer->x);
+   drmModeAtomicAddProperty(req, id, layer->props.crtc_y, layer->y);
+   drmModeAtomicAddProperty(req, id, layer->props.crtc_w, layer->width);
+   drmModeAtomicAddProperty(req, id, layer->props.crtc_h, layer->height);
+}
+
+/*
+ * Presentation timing: every presented frame records when its rendering was
+ * submitted, when eglSwapBuffers returned, when the flip was queued and the
+ * vblank timestamp and sequence reported by the flip event.  On exit the log
+ * is summarized as render-to-photon latency and frame interval histograms,
+ * and dumped as CSV for further processing.  The kernel timestamps a flip
+ * at the start of scanout of the new buffer, so vblank minus render time is
+ * the latency up to the first scanline.
+ *
+ * Async (tearing) flips happen as soon as the hardware latches the new
+ * address, mid-scanout, and their events carry the timestamp of the last
+ * vblank instead.  For those the time the event reached us is the best
+ * estimate of when the frame started to show up.
+ */
+
+struct flip_event {
+   int pending;
+   unsigned int sequence;
+   uint64_t time_ns;
+   uint64_t event_ns;
+};
+
+struct frame_time {
+   uint64_t render_ns;
+   uint64_t swap_ns;
+   uint64_t flip_ns;
+   uint64_t vblank_ns;
+   uint64_t event_ns;
+   unsigned int sequence;
+};
+
+struct frame_log {
+   struct frame_time *frames;
+   int count, size;
+   uint64_t refresh_ns;
+   int async;
+
+   /* filled in by frame_log_dump */
+   double fps, latency_p50, latency_p99;
+};
+
+static volatile sig_atomic_t quit;
+
+static void
+sigint_handler(int sig)
+{
+   (void)sig;
+   quit = 1;
+}
+
+static uint64_t
+now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+page_flip_handler(int fd, unsigned int frame,
+                  unsigned int sec, unsigned int usec, void *data)
+{
+   struct flip_event *event = data;
+
+   (void)fd;
+   event->pending = 0;
+   event->sequence = frame;
+   event->time_ns = sec * 1000000000ull + usec * 1000ull;
+   event->event_ns = now_ns();
+}
+
+static int
+wait_for_flip(int fd, struct flip_event *event)
+{
+   drmEventContext evctx = {
+      .version = 2,
+      .page_flip_handler = page_flip_handler,
+   };
+   struct pollfd pfd = {
+      .fd = fd,
+      .events = POLLIN,
+   };
+
+   while (event->pending) {
+      if (poll(&pfd, 1, -1) < 0) {
+         if (errno == EINTR)
+            continue;
+         fprintf(stderr, "poll failed: %m\n");
+         return -1;
+      }
+      drmHandleEvent(fd, &evctx);
+   }
+
+   return 0;
+}
+
+static int
+frame_log_init(struct frame_log *log, int fd, const drmModeModeInfo *mode,
+               int frames)
+{
+   uint64_t cap = 0;
+
+   if (drmGetCap(fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) || !cap)
+      fprintf(stderr, "warning: vblank timestamps are not CLOCK_MONOTONIC, "
+              "latencies will be meaningless\n");
+
+   log->count = 0;
+   log->size = frames;
+   log->async = 0;
+   log->frames = calloc(frames > 0 ? frames : 1, sizeof *log->frames);
+   log->refresh_ns = (uint64_t)mode->htotal * mode->vtotal * 1000000 / mode->clock;
+
+   return log->frames ? 0 : -1;
+}
+
+/* The returned slot only counts once the caller bumps log->count, so
+ * a frame that never made it to the screen is dropped from the log. */
+static struct frame_time *
+frame_log_next(struct frame_log *log)
+{
+   if (log->count >= log->size)
+      return NULL;
+   return &log->frames[log->count];
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+
+   return x < y ? -1 : x > y;
+}
+
+static void
+print_histogram(const char *title, const double *values, int count,
+                double bucket_ms, int buckets)
+{
+   int *hist = calloc(buckets, sizeof(int));
+   int i, max = 1;
+
+   for (i = 0; i < count; i++) {
+      int b = values[i] / bucket_ms;
+
+      if (b < 0)
+         b = 0;
+      if (b >= buckets)
+         b = buckets - 1;
+      hist[b]++;
+   }
+
+   for (i = 0; i < buckets; i++)
+      if (hist[i] > max)
+         max = hist[i];
+
+   printf("%s:\n", title);
+   for (i = 0; i < buckets; i++) {
+      if (!hist[i])
+         continue;
+      printf("  %6.2f%s ms %6d %.*s\n", i * bucket_ms,
+             i == buckets - 1 ? "+" : " ", hist[i],
+             hist[i] * 50 / max, "##################################################");
+   }
+
+   free(hist);
+}
+
+static void
+print_percentiles(const char *title, double *values, int count)
+{
+   double sum = 0;
+   int i;
+
+   if (!count)
+      return;
+
+   for (i = 0; i < count; i++)
+      sum += values[i];
+
+   qsort(values, count, sizeof(double), compare_double);
+   printf("%s: min %.3f avg %.3f p50 %.3f p99 %.3f max %.3f ms\n", title,
+          values[0], sum / count, values[count / 2],
+          values[(count * 99) / 100], values[count - 1]);
+}
+
+static uint64_t
+scanout_ns(const struct frame_log *log, const struct frame_time *f)
+{
+   return log->async ? f->event_ns : f->vblank_ns;
+}
+
+/* csv= with prefix in front of the file name, in the same directory */
+static void
+csv_name_prefixed(char *name, size_t size, const char *prefix, const char *csv)
+{
+   const char *base = strrchr(csv, '/');
+
+   base = base ? base + 1 : csv;
+   snprintf(name, size, "%.*s%s%s", (int) (base - csv), csv, prefix, base);
+}
+
+static void
+frame_log_dump(struct frame_log *log, const char *csv_name)
+{
+   double refresh_ms = log->refresh_ns / 1e6;
+   double *latency = calloc(log->count + 1, sizeof(double));
+   double *interval = calloc(log->count + 1, sizeof(double));
+   double mean = 0, variance = 0;
+   unsigned int missed = 0;
+   int i, intervals = 0;
+   FILE *csv;
+
+   csv = fopen(csv_name, "w");
+   if (csv)
+      fprintf(csv, "frame,sequence,render_ns,swap_ns,flip_ns,vblank_ns,event_ns,"
+              "latency_ns,interval_ns,missed\n");
+   else
+      fprintf(stderr, "Could not open file %s for writing\n", csv_name);
+
+   for (i = 0; i < log->count; i++) {
+      struct frame_time *f = &log->frames[i];
+      uint64_t interval_ns = 0;
+      unsigned int skipped = 0;
+
+      latency[i] = (scanout_ns(log, f) - f->render_ns) / 1e6;
+
+      if (i > 0) {
+         struct frame_time *prev = &log->frames[i - 1];
+
+         interval_ns = scanout_ns(log, f) - scanout_ns(log, prev);
+         interval[intervals++] = interval_ns / 1e6;
+         if (!log->async && f->sequence - prev->sequence > 1)
+            skipped = f->sequence - prev->sequence - 1;
+         missed += skipped;
+      }
+
+      if (csv)
+         fprintf(csv, "%d,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%u\n",
+                 i, f->sequence,
+                 (unsigned long long)f->render_ns,
+                 (unsigned long long)f->swap_ns,
+                 (unsigned long long)f->flip_ns,
+                 (unsigned long long)f->vblank_ns,
+                 (unsigned long long)f->event_ns,
+                 (unsigned long long)(scanout_ns(log, f) - f->render_ns),
+                 (unsigned long long)interval_ns, skipped);
+   }
+
+   if (csv) {
+      fclose(csv);
+      printf("frame times written to %s\n", csv_name);
+   }
+
+   for (i = 0; i < intervals; i++)
+      mean += interval[i];
+   if (intervals)
+      mean /= intervals;
+   for (i = 0; i < intervals; i++)
+      variance += (interval[i] - mean) * (interval[i] - mean);
+   if (intervals)
+      variance /= intervals;
+
+   log->fps = mean > 0 ? 1000 / mean : 0;
+
+   printf("%d frames, refresh %.3f ms, %.2f fps, ", log->count, refresh_ms, log->fps);
+   if (log->async)
+      printf("async flips\n");
+   else
+      printf("%u missed vblanks\n", missed);
+   printf("frame interval: mean %.3f ms, jitter (stddev) %.3f ms\n",
+          mean, sqrt(variance));
+
+   print_histogram("render-to-photon latency", latency, log->count,
+                   refresh_ms / 4, 24);
+   print_histogram("frame interval", interval, intervals,
+                   refresh_ms / 4, 24);
+   print_percentiles("render-to-photon latency", latency, log->count);
+   print_percentiles("frame interval", interval, intervals);
+
+   /* print_percentiles sorted the values */
+   log->latency_p50 = log->count ? latency[log->count / 2] : 0;
+   log->latency_p99 = log->count ? latency[(log->count * 99) / 100] : 0;
+
+   free(latency);
+   free(interval);
+   free(log->frames);
+}
+
+static struct gbm_bo *
+render_layer(struct layer *layer, EGLContext context)
+{
+   struct gbm_bo *bo;
+
+   surface = layer->surface;
+   eglMakeCurrent(display, surface, surface, context);
+   glUseProgram(program);
+   glDisable(GL_BLEND);
+   glViewport(0, 0, layer->width, layer->height);
+   glClearColor(layer->color[0], layer->color[1],
+                layer->color[2], layer->color[3]);
+   Render();
+
+   bo = gbm_surface_lock_front_buffer(layer->gs);
+   if (!bo || !drm_fb_get_from_bo(bo)) {
+      fprintf(stderr, "failed to get a scanout buffer for layer %s\n",
+              layer->name);
+      return NULL;
+   }
+
+   return bo;
+}
+
+static void
+present_layer(struct layer *layer, struct gbm_bo *bo)
+{
+   if (layer->bo)
+      gbm_surface_release_buffer(layer->gs, layer->bo);
+   layer->bo = bo;
+}
+
+static const char comp_vertex_source[] =
+   "attribute vec2 positionIn;\n"
+   "attribute vec2 texcoordIn;\n"
+   "varying vec2 texcoord;\n"
+   "void main() {\n"
+   "   texcoord = texcoordIn;\n"
+   "   gl_Position = vec4(positionIn, 0.0, 1.0);\n"
+   "}\n";
+
+static const char comp_fragment_source[] =
+   "precision mediump float;\n"
+   "uniform sampler2D tex;\n"
+   "varying vec2 texcoord;\n"
+   "void main() {\n"
+   "   gl_FragColor = texture2D(tex, texcoord);\n"
+   "}\n";
+
+static GLuint
+create_comp_program(void)
+{
+   const char *sources[2] = { comp_vertex_source, comp_fragment_source };
+   GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+   GLuint comp_program;
+   GLint stat;
+   int i;
+
+   comp_program = glCreateProgram();
+   for (i = 0; i < 2; i++) {
+      GLuint shader = glCreateShader(types[i]);
+
+      glShaderSource(shader, 1, &sources[i], NULL);
+      glCompileShader(shader);
+      glGetShaderiv(shader, GL_COMPILE_STATUS, &stat);
+      if (!stat) {
+         fprintf(stderr, "Error: composition shader did not compile!\n");
+         return 0;
+      }
+      glAttachShader(comp_program, shader);
+      glDeleteShader(shader);
+   }
+
+   glBindAttribLocation(comp_program, 0, "positionIn");
+   glBindAttribLocation(comp_program, 1, "texcoordIn");
+   glLinkProgram(comp_program);
+   glGetProgramiv(comp_program, GL_LINK_STATUS, &stat);
+   if (!stat) {
+      fprintf(stderr, "Error: composition program did not link!\n");
+      return 0;
+   }
+
+   return comp_program;
+}
+
+/* Full-screen GPU composition of all layers into the primary buffer, the
+ * pass that overlay planes let us skip. */
+static struct gbm_bo *
+compose_layers(struct layer *out, struct layer *layers, GLuint comp_program,
+               EGLContext context)
+{
+   struct gbm_bo *bo;
+   int l;
+
+   surface = out->surface;
+   eglMakeCurrent(display, surface, surface, context);
+   glUseProgram(comp_program);
+   glViewport(0, 0, out->width, out->height);
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+   for (l = 0; l < NUM_LAYERS; l++) {
+      struct layer *layer = &layers[l];
+      GLfloat x0 = 2.0f * layer->x / out->width - 1.0f;
+      GLfloat x1 = 2.0f * (layer->x + (int)layer->width) / out->width - 1.0f;
+      GLfloat y0 = 1.0f - 2.0f * layer->y / out->height;
+      GLfloat y1 = 1.0f - 2.0f * (layer->y + (int)layer->height) / out->height;
+      /* row 0 of a scanout buffer is the top of the image */
+      GLfloat quad[] = {
+         x0, y1, 0, 1,
+         x1, y1, 1, 1,
+         x0, y0, 0, 0,
+         x1, y0, 1, 0,
+      };
+      GLuint texture = drm_fb_get_texture(drm_fb_get_from_bo(layer->bo));
+
+      if (!texture)
+         return NULL;
+
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), quad);
+      glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), quad + 2);
+      glEnableVertexAttribArray(0);
+      glEnableVertexAttribArray(1);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+   }
+
+   glDisableVertexAttribArray(0);
+   glDisableVertexAttribArray(1);
+   eglSwapBuffers(display, surface);
+
+   bo = gbm_surface_lock_front_buffer(out->gs);
+   if (!bo || !drm_fb_get_from_bo(bo)) {
+      fprintf(stderr, "failed to get a scanout buffer for composition\n");
+      return NULL;
+   }
+
+   return bo;
+}
+
+static int
+create_layer(struct gbm_device *gbm, EGLConfig config, struct layer *layer)
+{
+   layer->gs = gbm_surface_create(gbm, layer->width, layer->height,
+                                  GBM_FORMAT_ARGB8888,
+                                  GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+   if (!layer->gs) {
+      fprintf(stderr, "failed to create gbm surface for layer %s\n", layer->name);
+      return -1;
+   }
+
+   layer->surface = eglCreateWindowSurface(display, config,
+                                           (EGLNativeWindowType)layer->gs, NULL);
+   if (layer->surface == EGL_NO_SURFACE) {
+      fprintf(stderr, "failed to create egl surface for layer %s\n", layer->name);
+      return -1;
+   }
+
+   return 0;
+}
+
+static void
+destroy_layer(struct layer *layer)
+{
+   if (layer->bo)
+      gbm_surface_release_buffer(layer->gs, layer->bo);
+   if (layer->surface != EGL_NO_SURFACE)
+      eglDestroySurface(display, layer->surface);
+   if (layer->gs)
+      gbm_surface_destroy(layer->gs);
+}
+
+static void
+move_layers(struct layer *layers, const drmModeModeInfo *mode, int frame)
 {
-   drmModeRes *resources = NULL;
-   drmModeConnector *connector = NULL;
-   drmModeEncoder *encoder = NULL;
-   int i;
+   struct layer *sprite = &layers[LAYER_SPRITE];
+   struct layer *cursor = &layers[LAYER_CURSOR];
+   int max_x = mode->hdisplay - sprite->width;
+   int max_y = mode->vdisplay - sprite->height;
+
+   sprite->x += sprite->dx;
+   sprite->y += sprite->dy;
+   if (sprite->x < 0 || sprite->x > max_x) {
+      sprite->dx = -sprite->dx;
+      sprite->x = sprite->x < 0 ? 0 : max_x;
+   }
+   if (sprite->y < 0 || sprite->y > max_y) {
+      sprite->dy = -sprite->dy;
+      sprite->y = sprite->y < 0 ? 0 : max_y;
+   }
+
+   /* sweep the cursor diagonally back and forth across the screen */
+   cursor->x = (frame * 7) % (mode->hdisplay - cursor->width);
+   cursor->y = (frame * 5) % (mode->vdisplay - cursor->height);
+
+   /* the sprite content is animated too, so it is re-rendered each frame */
+   sprite->color[0] = (frame % 120) / 120.0f;
+}
+
+static double
+elapsed(const struct timespec *start, const struct timespec *end)
+{
+   return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Takeover: when the CRTC already runs the mode we want (typically left
+ * behind by fbcon, plymouth or a previous client), there is no need for a
+ * full modeset, which blanks the panel for several frames.  Flipping our
+ * framebuffer in, and the saved one back in on exit, is seamless.
+ */
+static int
+mode_equal(const drmModeModeInfo *a, const drmModeModeInfo *b)
+{
+   return a->clock == b->clock &&
+          a->hdisplay == b->hdisplay &&
+          a->hsync_start == b->hsync_start &&
+          a->hsync_end == b->hsync_end &&
+          a->htotal == b->htotal &&
+          a->hskew == b->hskew &&
+          a->vdisplay == b->vdisplay &&
+          a->vsync_start == b->vsync_start &&
+          a->vsync_end == b->vsync_end &&
+          a->vtotal == b->vtotal &&
+          a->vscan == b->vscan &&
+          a->flags == b->flags;
+}
+
+static int
+can_take_over(const drmModeCrtc *crtc, const drmModeModeInfo *mode)
+{
+   if (!crtc->mode_valid || !crtc->buffer_id) {
+      printf("takeover: crtc %u is not active, doing a full modeset\n",
+             crtc->crtc_id);
+      return 0;
+   }
+
+   if (!mode_equal(&crtc->mode, mode)) {
+      printf("takeover: crtc %u runs %s, not %s, doing a full modeset\n",
+             crtc->crtc_id, crtc->mode.name, mode->name);
+      return 0;
+   }
+
+   printf("takeover: crtc %u already runs %s, skipping the modeset\n",
+          crtc->crtc_id, mode->name);
+   return 1;
+}
+
+static int
+flip_to(int fd, uint32_t crtc_id, uint32_t fb_id)
+{
+   struct flip_event flip = { .pending = 1 };
+
+   if (drmModePageFlip(fd, crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, &flip)) {
+      fprintf(stderr, "failed to flip to fb %u: %m\n", fb_id);
+      return -1;
+   }
+
+   return wait_for_flip(fd, &flip);
+}
+
+static int
+run_planes(int fd, struct gbm_device *gbm, struct kms *kms, int frames,
+           const char *csv, int takeover)
+{
+   struct layer layers[NUM_LAYERS] = {
+      [LAYER_BACKGROUND] = {
+         .name = "background",
+         .plane_type = DRM_PLANE_TYPE_PRIMARY,
+         .width = kms->mode.hdisplay, .height = kms->mode.vdisplay,
+         .color = { 0.1f, 0.1f, 0.3f, 1.0f },
+      },
+      [LAYER_SPRITE] = {
+         .name = "sprite",
+         .plane_type = DRM_PLANE_TYPE_OVERLAY,
+         .width = 256, .height = 256,
+         .dx = 5, .dy = 3,
+         .color = { 0.0f, 0.5f, 0.5f, 1.0f },
+      },
+      [LAYER_CURSOR] = {
+         .name = "cursor",
+         .plane_type = DRM_PLANE_TYPE_CURSOR,
+         .width = 64, .height = 64,
+         .color = { 0.0f, 0.0f, 0.0f, 0.0f },
+      },
+   };
+   struct layer comp = {
+      .name = "composition",
+      .width = kms->mode.hdisplay, .height = kms->mode.vdisplay,
+   };
+   static const EGLint context_attribs[] = {
+      EGL_CONTEXT_CLIENT_VERSION, 2,
+      EGL_NONE
+   };
+   uint32_t crtc_id = kms->encoder->crtc_id;
+   uint32_t conn_crtc_prop, mode_prop, active_prop, mode_blob = 0;
+   struct layer *primary = &layers[LAYER_BACKGROUND];
+   drmModeCrtcPtr saved_crtc = NULL;
+   drmModeAtomicReq *req;
+   struct flip_event flip = { 0 };
+   struct timespec start, end;
+   struct frame_log log;
+   GLuint comp_program = 0;
+   EGLContext context;
+   EGLConfig config;
+   uint64_t cap;
+   int composite, seamless;
+   uint32_t modeset_flags = 0;
+   int i, l, ret = -1;
+
+   /* Planes are matched to the CRTC by its index */
+   if (kms->crtc_index < 0) {
+      fprintf(stderr, "planes mode needs an encoder bound to a CRTC, "
+              "connector %u has none\n", kms->connector->connector_id);
+      return -1;
+   }
+
+   if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+       drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+      fprintf(stderr, "planes mode needs atomic modesetting\n");
+      return -1;
+   }
+
+   if (drmGetCap(fd, DRM_CAP_CURSOR_WIDTH, &cap) == 0 && cap)
+      layers[LAYER_CURSOR].width = cap;
+   if (drmGetCap(fd, DRM_CAP_CURSOR_HEIGHT, &cap) == 0 && cap)
+      layers[LAYER_CURSOR].height = cap;
+
+   create_image = (void *)eglGetProcAddress("eglCreateImageKHR");
+   destroy_image = (void *)eglGetProcAddress("eglDestroyImageKHR");
+   image_target_texture_2d = (void *)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+   assert(create_image && destroy_image && image_target_texture_2d);
+
+   conn_crtc_prop = get_prop_id(fd, kms->connector->connector_id,
+                                DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+   mode_prop = get_prop_id(fd, crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+   active_prop = get_prop_id(fd, crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+   if (!conn_crtc_prop || !mode_prop || !active_prop ||
+       drmModeCreatePropertyBlob(fd, &kms->mode, sizeof(kms->mode), &mode_blob)) {
+      fprintf(stderr, "failed to look up modeset properties\n");
+      return -1;
+   }
+
+   composite = assign_planes(fd, kms, layers);
+   if (composite < 0 || !primary->plane_id) {
+      fprintf(stderr, "no primary plane for crtc %u\n", crtc_id);
+      goto destroy_blob;
+   }
+
+   config = choose_config(GBM_FORMAT_ARGB8888);
+   if (!config) {
+      fprintf(stderr, "no ARGB8888 config\n");
+      goto destroy_blob;
+   }
+
+   context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+   if (context == EGL_NO_CONTEXT) {
+      fprintf(stderr, "failed to create context\n");
+      goto destroy_blob;
+   }
+
+   for (l = 0; l < NUM_LAYERS; l++) {
+      if (create_layer(gbm, config, &layers[l]))
+         goto destroy_layers;
+   }
+
+   surface = layers[0].surface;
+   if (!eglMakeCurrent(display, surface, surface, context)) {
+      fprintf(stderr, "failed to make context current\n");
+      goto destroy_layers;
+   }
+   InitGLES(kms->mode.hdisplay, kms->mode.vdisplay);
+
+   for (l = 0; l < NUM_LAYERS; l++) {
+      struct gbm_bo *bo = render_layer(&layers[l], context);
+      if (!bo)
+         goto destroy_layers;
+      present_layer(&layers[l], bo);
+   }
+
+   saved_crtc = drmModeGetCrtc(fd, crtc_id);
+   if (saved_crtc == NULL)
+      goto destroy_layers;
+
+   /* with a matching mode the first commit is a plain plane update */
+   seamless = takeover && can_take_over(saved_crtc, &kms->mode);
+
+   req = drmModeAtomicAlloc();
+   if (!seamless) {
+      drmModeAtomicAddProperty(req, kms->connector->connector_id, conn_crtc_prop, crtc_id);
+      drmModeAtomicAddProperty(req, crtc_id, mode_prop, mode_blob);
+      drmModeAtomicAddProperty(req, crtc_id, active_prop, 1);
+      modeset_flags = DRM_MODE_ATOMIC_ALLOW_MODESET;
+   }
+
+   /* Ask the driver whether it can scan out all our layers directly */
+   if (!composite) {
+      int cursor = drmModeAtomicGetCursor(req);
+
+      for (l = 0; l < NUM_LAYERS; l++)
+         add_plane(req, &layers[l], crtc_id,
+                   drm_fb_get_from_bo(layers[l].bo)->fb_id);
+
+      if (drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_TEST_ONLY |
+                              modeset_flags, NULL)) {
+         printf("TEST_ONLY commit of %d planes failed: %m\n", NUM_LAYERS);
+         drmModeAtomicSetCursor(req, cursor);
+         composite = 1;
+      }
+   }
+
+   if (composite) {
+      printf("falling back to GPU composition\n");
+
+      comp.plane_id = primary->plane_id;
+      comp.props = primary->props;
+      if (create_layer(gbm, config, &comp))
+         goto free_req;
+
+      comp_program = create_comp_program();
+      if (!comp_program)
+         goto free_req;
+
+      present_layer(&comp, compose_layers(&comp, layers, comp_program, context));
+      if (!comp.bo)
+         goto free_req;
+      add_plane(req, &comp, crtc_id, drm_fb_get_from_bo(comp.bo)->fb_id);
+
+      /* the layers may still be on planes from a previous run */
+      for (l = LAYER_SPRITE; l < NUM_LAYERS; l++)
+         if (layers[l].plane_id)
+            add_plane(req, &layers[l], crtc_id, 0);
+   } else {
+      printf("scanning out %d layers on planes\n", NUM_LAYERS);
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   ret = drmModeAtomicCommit(fd, req, modeset_flags, NULL);
+   drmModeAtomicFree(req);
+   if (ret) {
+      fprintf(stderr, "failed to set mode: %m\n");
+      goto restore;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   printf("%s took %.3f ms\n", seamless ? "plane update" : "modeset",
+          elapsed(&start, &end) * 1000);
+
+   if (frame_log_init(&log, fd, &kms->mode, frames)) {
+      fprintf(stderr, "failed to allocate the frame log\n");
+      ret = -1;
+      goto restore;
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   for (i = 0; i < frames && !quit; i++) {
+      struct layer *sprite = &layers[LAYER_SPRITE];
+      struct gbm_bo *sprite_bo, *comp_bo = NULL;
+      struct frame_time *t = frame_log_next(&log);
+
+      move_layers(layers, &kms->mode, i);
+
+      t->render_ns = now_ns();
+      sprite_bo = render_layer(sprite, context);
+      if (!sprite_bo)
+         break;
+
+      req = drmModeAtomicAlloc();
+      if (composite) {
+         /* the composition samples the new sprite, so retire the old one
+          * right away; the GPU keeps reads and writes in order */
+         present_layer(sprite, sprite_bo);
+         comp_bo = compose_layers(&comp, layers, comp_program, context);
+         t->swap_ns = now_ns();
+         if (!comp_bo) {
+            drmModeAtomicFree(req);
+            break;
+         }
+         add_plane(req, &comp, crtc_id, drm_fb_get_from_bo(comp_bo)->fb_id);
+      } else {
+         t->swap_ns = now_ns();
+         add_plane(req, sprite, crtc_id, drm_fb_get_from_bo(sprite_bo)->fb_id);
+         add_plane(req, &layers[LAYER_CURSOR], crtc_id,
+                   drm_fb_get_from_bo(layers[LAYER_CURSOR].bo)->fb_id);
+      }
+
+      flip.pending = 1;
+      ret = drmModeAtomicCommit(fd, req, DRM_MODE_ATOMIC_NONBLOCK |
+                                DRM_MODE_PAGE_FLIP_EVENT, &flip);
+      drmModeAtomicFree(req);
+      if (ret) {
+         fprintf(stderr, "atomic commit failed: %m\n");
+         break;
+      }
+      t->flip_ns = now_ns();
+
+      if (wait_for_flip(fd, &flip))
+         break;
+      t->vblank_ns = flip.time_ns;
+      t->event_ns = flip.event_ns;
+      t->sequence = flip.sequence;
+      log.count++;
+
+      if (composite)
+         present_layer(&comp, comp_bo);
+      else
+         present_layer(sprite, sprite_bo);
+   }
+
+   clock_gettime(CLOCK_MONOTONIC, &end);
+
+   printf("%d frames in %.3f s, %.2f fps (%s)\n", i, elapsed(&start, &end),
+          i / elapsed(&start, &end), composite ? "GPU composition" : "planes");
+   if (composite) {
+      uint64_t bytes = (uint64_t)comp.width * comp.height * 4;
+
+      for (l = 0; l < NUM_LAYERS; l++)
+         bytes += (uint64_t)layers[l].width * layers[l].height * 4;
+      printf("composition traffic: %.2f MiB/frame, %.2f MiB/s\n",
+             bytes / 1048576.0, bytes / 1048576.0 * i / elapsed(&start, &end));
+   } else {
+      printf("composition traffic: none\n");
+   }
+
+   frame_log_dump(&log, csv);
+   ret = 0;
+
+restore:
+   /* legacy SetCrtc only knows about the primary plane */
+   req = drmModeAtomicAlloc();
+   for (l = LAYER_SPRITE; l < NUM_LAYERS; l++)
+      if (layers[l].plane_id)
+         add_plane(req, &layers[l], crtc_id, 0);
+   if (seamless) {
+      struct layer saved = {
+         .width = saved_crtc->width, .height = saved_crtc->height,
+         .plane_id = primary->plane_id, .props = primary->props,
+      };
+
+      add_plane(req, &saved, crtc_id, saved_crtc->buffer_id);
+   }
+   if (drmModeAtomicCommit(fd, req, 0, NULL))
+      seamless = 0;
+free_req:
+   drmModeAtomicFree(req);
+
+   if (!seamless &&
+       drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
+                      saved_crtc->x, saved_crtc->y,
+                      &kms->connector->connector_id, 1, &saved_crtc->mode))
+      fprintf(stderr, "failed to restore crtc: %m\n");
+   drmModeFreeCrtc(saved_crtc);
+destroy_layers:
+   eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+   destroy_layer(&comp);
+   for (l = 0; l < NUM_LAYERS; l++)
+      destroy_layer(&layers[l]);
+   if (comp_program)
+      glDeleteProgram(comp_program);
+   eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   eglDestroyContext(display, context);
+destroy_blob:
+   drmModeDestroyPropertyBlob(fd, mode_blob);
+
+   return ret;
+}
+
+/*
+ * Multi-head mode: every connected connector gets its own CRTC, GBM
+ * surface, EGL context and render thread running a vsync'ed flip loop.
+ * The flip events of all outputs arrive on the one DRM fd, so the main
+ * thread runs the only event loop and hands each event to its output.
+ */
+
+#define MAX_OUTPUTS 8
+
+struct output {
+   drmModeConnector *connector;
+   uint32_t crtc_id;
+   drmModeModeInfo mode;
+   drmModeCrtc *saved_crtc;
+
+   int fd;
+   struct gbm_device *gbm;
+   EGLConfig config;
+   int frames;
+   double seconds;
+
+   pthread_t thread;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   struct flip_event flip;
+   struct frame_log log;
+};
+
+static atomic_int outputs_running;
+
+static int
+pick_crtc(int fd, drmModeRes *resources, drmModeConnector *connector,
+          uint32_t taken)
+{
+   drmModeEncoder *encoder;
+   int i, j, index = -1;
+
+   /* keep the routing the connector already has when we can */
+   encoder = drmModeGetEncoder(fd, connector->encoder_id);
+   if (encoder) {
+      for (j = 0; j < resources->count_crtcs; j++)
+         if (resources->crtcs[j] == encoder->crtc_id && !(taken & (1 << j)))
+            index = j;
+      drmModeFreeEncoder(encoder);
+   }
+
+   for (i = 0; i < connector->count_encoders && index < 0; i++) {
+      encoder = drmModeGetEncoder(fd, connector->encoders[i]);
+      if (encoder == NULL)
+         continue;
+
+      for (j = 0; j < resources->count_crtcs && index < 0; j++)
+         if ((encoder->possible_crtcs & (1 << j)) && !(taken & (1 << j)))
+            index = j;
+
+      drmModeFreeEncoder(encoder);
+   }
+
+   return index;
+}
+
+static int
+setup_outputs(int fd, struct output *outputs, int fast)
+{
+   drmModeRes *resources;
+   drmModeConnector *connector;
+   uint32_t taken = 0;
+   int i, index, n = 0;
 
    resources = drmModeGetResources(fd);
    if (!resources) {
       fprintf(stderr, "drmModeGetResources failed\n");
-      return EGL_FALSE;
+      return 0;
    }
 
-   for (i = 0; i < resources->count_connectors; i++) {
-      connector = drmModeGetConnector(fd, resources->connectors[i]);
+   for (i = 0; i < resources->count_connectors && n < MAX_OUTPUTS; i++) {
+      connector = get_connector(fd, resources->connectors[i], fast);
       if (connector == NULL)
          continue;
 
-      if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+      if (connector->connection != DRM_MODE_CONNECTED || connector->count_modes == 0) {
+         drmModeFreeConnector(connector);
+         continue;
+      }
+
+      index = pick_crtc(fd, resources, connector, taken);
+      if (index < 0) {
+         fprintf(stderr, "no free crtc for connector %u\n", connector->connector_id);
+         drmModeFreeConnector(connector);
+         continue;
+      }
+      taken |= 1 << index;
+
+      outputs[n].connector = connector;
+      outputs[n].crtc_id = resources->crtcs[index];
+      outputs[n].mode = connector->modes[0];
+      outputs[n].saved_crtc = drmModeGetCrtc(fd, outputs[n].crtc_id);
+      printf("output %d: connector %u, crtc %u, %s\n", n,
+             connector->connector_id, outputs[n].crtc_id, outputs[n].mode.name);
+      n++;
+   }
+
+   drmModeFreeResources(resources);
+
+   return n;
+}
+
+static void
+output_flip_handler(int fd, unsigned int frame,
+                    unsigned int sec, unsigned int usec, void *data)
+{
+   struct output *output = data;
+
+   pthread_mutex_lock(&output->lock);
+   page_flip_handler(fd, frame, sec, usec, &output->flip);
+   pthread_cond_signal(&output->cond);
+   pthread_mutex_unlock(&output->lock);
+}
+
+static void *
+output_thread(void *data)
+{
+   static const EGLint context_attribs[] = {
+      EGL_CONTEXT_CLIENT_VERSION, 2,
+      EGL_NONE
+   };
+   struct output *output = data;
+   uint32_t connector_id = output->connector->connector_id;
+   struct gbm_bo *bo = NULL, *next_bo;
+   struct gbm_surface *gs;
+   struct timespec start, end;
+   EGLContext context;
+   struct drm_fb *fb;
+   int i;
+
+   eglBindAPI(EGL_OPENGL_ES_API);
+   context = eglCreateContext(display, output->config, EGL_NO_CONTEXT, context_attribs);
+   gs = gbm_surface_create(output->gbm, output->mode.hdisplay, output->mode.vdisplay,
+                           GBM_FORMAT_XRGB8888,
+                           GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+   surface = gs ? eglCreateWindowSurface(display, output->config,
+                                         (EGLNativeWindowType)gs, NULL)
+                : EGL_NO_SURFACE;
+
+   if (context == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE ||
+       !eglMakeCurrent(display, surface, surface, context)) {
+      fprintf(stderr, "connector %u: failed to set up rendering\n", connector_id);
+      goto out;
+   }
+
+   InitGLES(output->mode.hdisplay, output->mode.vdisplay);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+
+   for (i = 0; i < output->frames && !quit; i++) {
+      struct frame_time *t = frame_log_next(&output->log);
+
+      t->render_ns = now_ns();
+      Render();
+      t->swap_ns = now_ns();
+
+      next_bo = gbm_surface_lock_front_buffer(gs);
+      fb = next_bo ? drm_fb_get_from_bo(next_bo) : NULL;
+      if (!fb) {
+         fprintf(stderr, "connector %u: failed to get a new framebuffer\n",
+                 connector_id);
          break;
+      }
 
-      drmModeFreeConnector(connector);
+      /* the first frame goes through a modeset, which has no event */
+      if (!bo) {
+         if (drmModeSetCrtc(output->fd, output->crtc_id, fb->fb_id, 0, 0,
+                            &connector_id, 1, &output->mode)) {
+            fprintf(stderr, "connector %u: failed to set mode: %m\n", connector_id);
+            gbm_surface_release_buffer(gs, next_bo);
+            break;
+         }
+         bo = next_bo;
+         continue;
+      }
+
+      pthread_mutex_lock(&output->lock);
+      output->flip.pending = 1;
+      if (drmModePageFlip(output->fd, output->crtc_id, fb->fb_id,
+                          DRM_MODE_PAGE_FLIP_EVENT, output)) {
+         pthread_mutex_unlock(&output->lock);
+         fprintf(stderr, "connector %u: failed to queue page flip: %m\n",
+                 connector_id);
+         gbm_surface_release_buffer(gs, next_bo);
+         break;
+      }
+      t->flip_ns = now_ns();
+      while (output->flip.pending)
+         pthread_cond_wait(&output->cond, &output->lock);
+      pthread_mutex_unlock(&output->lock);
+
+      t->vblank_ns = output->flip.time_ns;
+      t->event_ns = output->flip.event_ns;
+      t->sequence = output->flip.sequence;
+      output->log.count++;
+
+      gbm_surface_release_buffer(gs, bo);
+      bo = next_bo;
    }
 
-   if (i == resources->count_connectors) {
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   output->seconds = elapsed(&start, &end);
+
+   /* restore before our framebuffers go away with the surface */
+   if (bo && output->saved_crtc &&
+       drmModeSetCrtc(output->fd, output->saved_crtc->crtc_id,
+                      output->saved_crtc->buffer_id,
+                      output->saved_crtc->x, output->saved_crtc->y,
+                      &connector_id, 1, &output->saved_crtc->mode))
+      fprintf(stderr, "connector %u: failed to restore crtc: %m\n", connector_id);
+
+out:
+   eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   if (surface != EGL_NO_SURFACE)
+      eglDestroySurface(display, surface);
+   if (gs)
+      gbm_surface_destroy(gs);
+   if (context != EGL_NO_CONTEXT)
+      eglDestroyContext(display, context);
+
+   atomic_fetch_sub(&outputs_running, 1);
+
+   return NULL;
+}
+
+static int
+run_outputs(int fd, struct gbm_device *gbm, int frames, const char *csv, int fast)
+{
+   struct output outputs[MAX_OUTPUTS] = { 0 };
+   drmEventContext evctx = {
+      .version = 2,
+      .page_flip_handler = output_flip_handler,
+   };
+   struct pollfd pfd = {
+      .fd = fd,
+      .events = POLLIN,
+   };
+   EGLConfig config;
+   double total_fps = 0;
+   int i, n, started = 0;
+
+   n = setup_outputs(fd, outputs, fast);
+   if (n == 0) {
       fprintf(stderr, "No currently active connector found.\n");
-      return EGL_FALSE;
+      return -1;
    }
 
-   for (i = 0; i < resources->count_encoders; i++) {
-      encoder = drmModeGetEncoder(fd, resources->encoders[i]);
+   config = choose_config(GBM_FORMAT_XRGB8888);
+   if (!config) {
+      fprintf(stderr, "no XRGB8888 config\n");
+      goto free_outputs;
+   }
 
-      if (encoder == NULL)
-         continue;
+   for (i = 0; i < n; i++) {
+      struct output *output = &outputs[i];
 
-      if (encoder->encoder_id == connector->encoder_id)
+      output->fd = fd;
+      output->gbm = gbm;
+      output->config = config;
+      output->frames = frames;
+      pthread_mutex_init(&output->lock, NULL);
+      pthread_cond_init(&output->cond, NULL);
+      if (frame_log_init(&output->log, fd, &output->mode, frames))
          break;
 
-      drmModeFreeEncoder(encoder);
+      atomic_fetch_add(&outputs_running, 1);
+      if (pthread_create(&output->thread, NULL, output_thread, output)) {
+         atomic_fetch_sub(&outputs_running, 1);
+         free(output->log.frames);
+         break;
+      }
+      started++;
    }
 
-   kms->connector = connector;
-   kms->encoder = encoder;
-   kms->mode = connector->modes[0];
+   while (atomic_load(&outputs_running) > 0) {
+      if (poll(&pfd, 1, 100) > 0)
+         drmHandleEvent(fd, &evctx);
+   }
 
-   return EGL_TRUE;
+   for (i = 0; i < started; i++) {
+      struct output *output = &outputs[i];
+      char name[256], prefix[32];
+
+      pthread_join(output->thread, NULL);
+
+      printf("\noutput %d (connector %u, crtc %u): %d frames in %.3f s, %.2f fps\n",
+             i, output->connector->connector_id, output->crtc_id,
+             output->log.count, output->seconds,
+             output->seconds > 0 ? output->log.count / output->seconds : 0);
+      if (output->seconds > 0)
+         total_fps += output->log.count / output->seconds;
+
+      snprintf(prefix, sizeof prefix, "conn%u-", output->connector->connector_id);
+      csv_name_prefixed(name, sizeof name, prefix, csv);
+      frame_log_dump(&output->log, name);
+   }
+
+   printf("\n%d outputs, %.2f fps in total\n", started, total_fps);
+
+free_outputs:
+   for (i = 0; i < n; i++) {
+      drmModeFreeCrtc(outputs[i].saved_crtc);
+      drmModeFreeConnector(outputs[i].connector);
+   }
+
+   return started == n ? 0 : -1;
+}
+
+/* Re-render and flip the scene, logging when each frame hits the screen.
+ * With async set the flips do not wait for vblank, so we render as fast as
+ * the GPU allows, at the price of tearing.  *bo is updated to the buffer
+ * left on screen. */
+static int
+run_flips(int fd, struct gbm_surface *gs, struct gbm_bo **bo, struct kms *kms,
+          int frames, const char *csv, int async, struct frame_log *log)
+{
+   uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+   struct flip_event flip = { 0 };
+   int i;
+
+   if (frame_log_init(log, fd, &kms->mode, frames)) {
+      fprintf(stderr, "failed to allocate the frame log\n");
+      return -1;
+   }
+
+   if (async) {
+      flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+      log->async = 1;
+   }
+
+   for (i = 0; i < frames && !quit; i++) {
+      struct frame_time *t = frame_log_next(log);
+      struct gbm_bo *next_bo;
+      struct drm_fb *fb;
+
+      t->render_ns = now_ns();
+      Render();
+      t->swap_ns = now_ns();
+
+      next_bo = gbm_surface_lock_front_buffer(gs);
+      fb = next_bo ? drm_fb_get_from_bo(next_bo) : NULL;
+      if (!fb) {
+         fprintf(stderr, "failed to get a new framebuffer\n");
+         break;
+      }
+
+      flip.pending = 1;
+      if (drmModePageFlip(fd, kms->encoder->crtc_id, fb->fb_id, flags, &flip)) {
+         fprintf(stderr, "failed to queue page flip: %m\n");
+         gbm_surface_release_buffer(gs, next_bo);
+         break;
+      }
+      t->flip_ns = now_ns();
+
+      if (wait_for_flip(fd, &flip))
+         break;
+      t->vblank_ns = flip.time_ns;
+      t->event_ns = flip.event_ns;
+      t->sequence = flip.sequence;
+      log->count++;
+
+      gbm_surface_release_buffer(gs, *bo);
+      *bo = next_bo;
+   }
+
+   frame_log_dump(log, csv);
+
+   return 0;
 }
 
 static const char device_name[] = "/dev/dri/card0";
@@ -88,7 +1755,7 @@ static const EGLint attribs[] = {
    EGL_NONE
 };
 
-int main(void)
+int main(int argc, char *argv[])
 {
    EGLConfig config;
    EGLint major, minor, n;
@@ -100,6 +1767,34 @@ int main(void)
    struct gbm_bo *bo;
    drmModeCrtcPtr saved_crtc;
    struct gbm_surface *gs;
+   const char *csv = "egl-color-kms.csv";
+   int planes = 0, multi = 0, async = 0, frames = 300, fast = 0, cache = 0, takeover = 0, seamless;
+   struct frame_log vsync_log, async_log;
+   int failed;
+   struct timespec start, end;
+   char cache_path[256];
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "planes") == 0)
+         planes = 1;
+      else if (strcmp(argv[i], "multi") == 0)
+         multi = 1;
+      else if (strncmp(argv[i], "frames=", 7) == 0)
+         frames = atoi(argv[i] + 7);
+      else if (strncmp(argv[i], "csv=", 4) == 0)
+         csv = argv[i] + 4;
+      else if (strcmp(argv[i], "fast") == 0)
+         fast = 1;
+      else if (strcmp(argv[i], "cache") == 0)
+         cache = fast = 1;
+      else if (strcmp(argv[i], "takeover") == 0)
+         takeover = 1;
+      else if (strcmp(argv[i], "async") == 0)
+         async = 1;
+   }
+
+   signal(SIGINT, sigint_handler);
 
    fd = open(device_name, O_RDWR);
    if (fd < 0) {
@@ -131,13 +1826,33 @@ int main(void)
    ver = eglQueryString(display, EGL_VERSION);
    printf("EGL_VERSION = %s\n", ver);
 
-   if (!setup_kms(fd, &kms)) {
-      ret = -1;
+   if (multi) {
+      ret = run_outputs(fd, gbm, frames, csv, fast);
       goto egl_terminate;
    }
 
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   kms_cache_path(fd, cache_path, sizeof cache_path);
+   if (!cache || !setup_kms_cached(fd, &kms, cache_path)) {
+      if (!setup_kms(fd, &kms, fast)) {
+         ret = -1;
+         goto egl_terminate;
+      }
+      if (cache)
+         kms_cache_save(&kms, cache_path);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   printf("setup_kms: connector %u, crtc %u, %s, %.3f ms\n",
+          kms.connector->connector_id, kms.encoder->crtc_id, kms.mode.name,
+          elapsed(&start, &end) * 1000);
+
    eglBindAPI(EGL_OPENGL_ES_API);
 
+   if (planes) {
+      ret = run_planes(fd, gbm, &kms, frames, csv, takeover);
+      goto egl_terminate;
+   }
+
    if (!eglChooseConfig(display, attribs, &config, 1, &n) || n != 1) {
       fprintf(stderr, "failed to choose argb config\n");
       ret = -1;
@@ -187,21 +1902,54 @@ int main(void)
    if (saved_crtc == NULL)
       goto rm_fb;
 
-   ret = drmModeSetCrtc(fd, kms.encoder->crtc_id, kms.fb_id, 0, 0,
-         &kms.connector->connector_id, 1, &kms.mode);
+   seamless = takeover && can_take_over(saved_crtc, &kms.mode);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   if (seamless)
+      ret = flip_to(fd, kms.encoder->crtc_id, kms.fb_id);
+   else
+      ret = drmModeSetCrtc(fd, kms.encoder->crtc_id, kms.fb_id, 0, 0,
+            &kms.connector->connector_id, 1, &kms.mode);
    if (ret) {
       fprintf(stderr, "failed to set mode: %m\n");
       goto free_saved_crtc;
    }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   printf("%s took %.3f ms\n", seamless ? "page flip" : "modeset",
+          elapsed(&start, &end) * 1000);
 
-   sleep(1);
+   failed = run_flips(fd, gs, &bo, &kms, frames, csv, 0, &vsync_log);
 
-   ret = drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
-                        saved_crtc->x, saved_crtc->y,
-                        &kms.connector->connector_id, 1, &saved_crtc->mode);
+   /* run the same scene again with tearing flips for comparison */
+   if (async && !failed) {
+      uint64_t cap = 0;
+      char name[256];
+
+      if (drmGetCap(fd, DRM_CAP_ASYNC_PAGE_FLIP, &cap) || !cap) {
+         fprintf(stderr, "driver does not support async page flips\n");
+      } else if (!quit) {
+         csv_name_prefixed(name, sizeof name, "async-", csv);
+         printf("\nasync page flips:\n");
+         failed = run_flips(fd, gs, &bo, &kms, frames, name, 1, &async_log);
+         if (!failed) {
+            printf("\n%-6s %10s %16s %16s\n", "mode", "fps", "latency p50", "latency p99");
+            printf("%-6s %10.2f %13.3f ms %13.3f ms\n", "vsync",
+                   vsync_log.fps, vsync_log.latency_p50, vsync_log.latency_p99);
+            printf("%-6s %10.2f %13.3f ms %13.3f ms\n", "async",
+                   async_log.fps, async_log.latency_p50, async_log.latency_p99);
+         }
+      }
+   }
+
+   if (!seamless || flip_to(fd, saved_crtc->crtc_id, saved_crtc->buffer_id))
+      ret = drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
+                           saved_crtc->x, saved_crtc->y,
+                           &kms.connector->connector_id, 1, &saved_crtc->mode);
    if (ret) {
       fprintf(stderr, "failed to restore crtc: %m\n");
    }
+   if (failed)
+      ret = -1;
 
 free_saved_crtc:
    drmModeFreeCrtc(saved_crtc);
@@ -4,12 +4,11 @@
 #include <fcntl.h>
 #include <string.h>
 #include <gbm.h>
-#include <png.h>
 #include <epoxy/gl.h>
 #include <epoxy/egl.h>
 
 extern EGLDisplay display;
-extern EGLSurface surface;
+extern __thread EGLSurface surface;
 
 #define TARGET_SIZE 256
 
@@ -18,6 +17,7 @@ struct gbm_surface *gs;
 
 void InitGLES(int width, int height);
 void Render(void);
+int writeImage(char* filename, int width, int height, void *buffer, char* title);
 
 EGLConfig get_config(void)
 {
@@ -95,78 +95,6 @@ void RenderTargetInit(void)
 	assert(eglMakeCurrent(display, surface, surface, context) == EGL_TRUE);
 }
 
-int writeImage(char* filename, int width, int height, void *buffer, char* title)
-{
-	int code = 0;
-	FILE *fp = NULL;
-	png_structp png_ptr = NULL;
-	png_infop info_ptr = NULL;
-
-	// Open file for writing (binary mode)
-	fp = fopen(filename, "wb");
-	if (fp == NULL) {
-		fprintf(stderr, "Could not open file %s for writing\n", filename);
-		code = 1;
-		goto finalise;
-	}
-
-	// Initialize write structure
-	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if (png_ptr == NULL) {
-		fprintf(stderr, "Could not allocate write struct\n");
-		code = 1;
-		goto finalise;
-	}
-
-	// Initialize info structure
-	info_ptr = png_create_info_struct(png_ptr);
-	if (info_ptr == NULL) {
-		fprintf(stderr, "Could not allocate info struct\n");
-		code = 1;
-		goto finalise;
-	}
-
-	// Setup Exception handling
-	if (setjmp(png_jmpbuf(png_ptr))) {
-		fprintf(stderr, "Error during png creation\n");
-		code = 1;
-		goto finalise;
-	}
-
-	png_init_io(png_ptr, fp);
-
-	// Write header (8 bit colour depth)
-	png_set_IHDR(png_ptr, info_ptr, width, height,
-			8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-	// Set title
-	if (title != NULL) {
-		png_text title_text;
-		title_text.compression = PNG_TEXT_COMPRESSION_NONE;
-		title_text.key = "Title";
-		title_text.text = title;
-		png_set_text(png_ptr, info_ptr, &title_text, 1);
-	}
-
-	png_write_info(png_ptr, info_ptr);
-
-	// Write image data
-	int i;
-	for (i = 0; i < height; i++)
-		png_write_row(png_ptr, (png_bytep)buffer + i * width * 4);
-
-	// End write
-	png_write_end(png_ptr, NULL);
-
-finalise:
-	if (fp != NULL) fclose(fp);
-	if (info_ptr != NULL) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-	if (png_ptr != NULL) png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-
-	return code;
-}
-
 int main(void)
 {
 	RenderTargetInit();
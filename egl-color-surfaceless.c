@@ -0,0 +1,68 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+
+/* egl-color without any window system or device node : the surfaceless
+ * platform, or else the first EGL device, which is llvmpipe when there is
+ * no GPU. The scene goes to a framebuffer object and gets saved as a PNG
+ * the same way egl-color-png does. */
+
+extern EGLDisplay display;
+extern __thread EGLSurface surface;
+
+#define TARGET_SIZE 256
+
+void InitGLES(int width, int height);
+void Render(void);
+int writeImage(char* filename, int width, int height, void *buffer, char* title);
+EGLDisplay OffscreenDisplay(int use_device, int device, EGLConfig *config);
+
+void RenderTargetInit(int use_device)
+{
+	EGLConfig config;
+
+	assert((display = OffscreenDisplay(use_device, -1, &config)) != EGL_NO_DISPLAY);
+
+	EGLContext context;
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	assert((context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs)) != EGL_NO_CONTEXT);
+
+	surface = EGL_NO_SURFACE;
+	assert(eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_TRUE);
+
+	GLuint texture, fbo;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TARGET_SIZE, TARGET_SIZE, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, texture, 0);
+	assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+}
+
+int main(int argc, char **argv)
+{
+	int use_device = argc > 1 && strcmp(argv[1], "device") == 0;
+
+	RenderTargetInit(use_device);
+	InitGLES(TARGET_SIZE, TARGET_SIZE);
+	// Swapping without a surface fails, and that's fine.
+	Render();
+
+	GLubyte result[TARGET_SIZE * TARGET_SIZE * 4] = {0};
+	glReadPixels(0, 0, TARGET_SIZE, TARGET_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, result);
+	assert(glGetError() == GL_NO_ERROR);
+	assert(!writeImage("screenshot.png", TARGET_SIZE, TARGET_SIZE, result, "hello"));
+	return 0;
+}
@@ -0,0 +1,403 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+
+#include "latency.h"
+
+/* One big egl-color frame rendered offscreen by several threads at once,
+ * each with its own context. The frame is cut in tiles=CxR tiles, which
+ * the workers take one after the other. A worker draws the whole scene
+ * into a framebuffer the size of a tile, with the viewport moved so its
+ * tile is the part that lands there, and reads it back straight into its
+ * place in the frame : nothing gets copied to stitch the tiles together.
+ *
+ * Reading into the middle of a row takes GL_PACK_ROW_LENGTH, so more
+ * than one column needs ES 3 or GL_NV_pack_subimage. Tiles that are
+ * whole rows work everywhere, that's the default.
+ *
+ * The frame is first rendered whole by one context, then in tiles by 1,
+ * 2, 4... up to threads= workers, and each tiled frame is compared to
+ * the whole one. With devices, workers go round robin over every EGL
+ * device instead of all using the first one, for hosts with more than
+ * one GPU. png= saves the last tiled frame.
+ */
+
+extern __thread GLuint program;
+
+void InitGLES(int width, int height);
+int writeImage(char* filename, int width, int height, void *buffer, char* title);
+EGLDisplay OffscreenDisplay(int use_device, int device, EGLConfig *config);
+int OffscreenDeviceCount(void);
+
+#define MAX_WORKERS 64
+#define MAX_DEVICES 16
+
+struct target {
+	EGLDisplay display;
+	EGLConfig config;
+};
+
+struct frame {
+	int width, height;
+	int columns, rows;
+	int tile_width, tile_height;
+	/* the frame, bottom row first as glReadPixels gives it */
+	GLubyte *pixels;
+
+	struct target targets[MAX_DEVICES];
+	int target_count;
+
+	/* how many are timed, after one more to warm up */
+	int frames;
+	atomic_int next_tile;
+	atomic_int failed;
+	pthread_barrier_t barrier;
+};
+
+struct worker_data {
+	struct frame *frame;
+	int index;
+	int tiles;
+};
+
+/* The surfaceless display, or every EGL device with devices */
+static void TargetsInit(struct frame *frame, int use_devices)
+{
+	int const count = use_devices ? OffscreenDeviceCount() : 1;
+
+	frame->target_count = 0;
+	for (int i = 0; i < count && frame->target_count < MAX_DEVICES; i++) {
+		struct target *target = &frame->targets[frame->target_count];
+
+		target->display = OffscreenDisplay(use_devices, use_devices ? i : -1,
+				&target->config);
+		if (target->display != EGL_NO_DISPLAY)
+			frame->target_count++;
+	}
+}
+
+static EGLContext CreateContext(struct target *target)
+{
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 3,
+		EGL_NONE
+	};
+	EGLContext context;
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+	context = eglCreateContext(target->display, target->config,
+			EGL_NO_CONTEXT, contextAttribs);
+	if (context != EGL_NO_CONTEXT)
+		return context;
+
+	/* ES 2 only, good enough for tiles of whole rows */
+	contextAttribs[1] = 2;
+	return eglCreateContext(target->display, target->config,
+			EGL_NO_CONTEXT, contextAttribs);
+}
+
+/* The egl-color scene, without swapping */
+static void Draw(void)
+{
+	GLfloat vertex[] = {
+		-1, -1, 0,
+		-1, 1, 0,
+		1, 1, 0,
+	};
+	GLfloat color[] = {
+		1, 0, 0, 1,
+		0, 1, 0, 1,
+		0, 0, 1, 1,
+	};
+
+	GLint position = glGetAttribLocation(program, "positionIn");
+	glEnableVertexAttribArray(position);
+	glVertexAttribPointer(position, 3, GL_FLOAT, 0, 0, vertex);
+
+	GLint colorIn = glGetAttribLocation(program, "colorIn");
+	glEnableVertexAttribArray(colorIn);
+	glVertexAttribPointer(colorIn, 4, GL_FLOAT, 0, 0, color);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static void DrawTile(struct frame *frame, int tile)
+{
+	int const x = tile % frame->columns * frame->tile_width;
+	int const y = tile / frame->columns * frame->tile_height;
+	int const width = frame->width - x < frame->tile_width ?
+		frame->width - x : frame->tile_width;
+	int const height = frame->height - y < frame->tile_height ?
+		frame->height - y : frame->tile_height;
+
+	/* The whole frame's viewport, moved so this tile is the part at the
+	 * framebuffer's origin. The rest is clipped away. */
+	glViewport(-x, -y, frame->width, frame->height);
+	Draw();
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+			frame->pixels + ((size_t) y * frame->width + x) * 4);
+}
+
+/* What this context can't do for this frame, or NULL */
+static const char *CheckLimits(struct frame *frame)
+{
+	GLint viewport[2], texture;
+
+	glGetIntegerv(GL_MAX_VIEWPORT_DIMS, viewport);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &texture);
+
+	if (frame->width > viewport[0] || frame->height > viewport[1])
+		return "frame larger than the biggest viewport";
+	if (frame->tile_width > texture || frame->tile_height > texture)
+		return "tile larger than the biggest texture";
+	if (frame->tile_width < frame->width &&
+	    strncmp((const char *) glGetString(GL_VERSION), "OpenGL ES 3", 11) &&
+	    !epoxy_has_gl_extension("GL_NV_pack_subimage"))
+		return "no GL_PACK_ROW_LENGTH to read tiles in place, use tiles=1xN";
+
+	return NULL;
+}
+
+static void *worker(void *data)
+{
+	struct worker_data *worker = data;
+	struct frame *frame = worker->frame;
+	struct target *target =
+		&frame->targets[worker->index % frame->target_count];
+	const char *error = NULL;
+	GLuint texture = 0, fbo = 0;
+	int const count = frame->columns * frame->rows;
+	EGLContext context;
+
+	context = CreateContext(target);
+	if (context == EGL_NO_CONTEXT ||
+	    !eglMakeCurrent(target->display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		error = "could not create a context";
+	else
+		error = CheckLimits(frame);
+
+	if (!error) {
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, frame->tile_width,
+				frame->tile_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				GL_TEXTURE_2D, texture, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			error = "incomplete framebuffer";
+	}
+
+	if (!error) {
+		/* Before the first barrier, so no frame pays for linking */
+		InitGLES(frame->tile_width, frame->tile_height);
+		if (frame->tile_width < frame->width)
+			glPixelStorei(GL_PACK_ROW_LENGTH, frame->width);
+	} else {
+		fprintf(stderr, "worker %d : %s (0x%x)\n", worker->index, error,
+				eglGetError());
+		atomic_fetch_add(&frame->failed, 1);
+	}
+
+	/* Those that failed still go through the barriers, the others take
+	 * their tiles */
+	pthread_barrier_wait(&frame->barrier);
+	for (int f = 0; f <= frame->frames; f++) {
+		int tile;
+
+		pthread_barrier_wait(&frame->barrier);
+		while (!error &&
+		       (tile = atomic_fetch_add(&frame->next_tile, 1)) < count) {
+			DrawTile(frame, tile);
+			worker->tiles++;
+		}
+		pthread_barrier_wait(&frame->barrier);
+	}
+
+	if (context != EGL_NO_CONTEXT) {
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &texture);
+		glDeleteProgram(program);
+		eglMakeCurrent(target->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+				EGL_NO_CONTEXT);
+		eglDestroyContext(target->display, context);
+	}
+	eglReleaseThread();
+
+	return NULL;
+}
+
+/* ms per frame, or 0 when the frame didn't get rendered */
+static double run_frames(struct frame *frame, int workers, int *busiest)
+{
+	pthread_t threads[MAX_WORKERS];
+	struct worker_data data[MAX_WORKERS];
+	int const count = frame->columns * frame->rows;
+	uint64_t total_ns = 0;
+	int complete = 1;
+
+	frame->tile_width = (frame->width + frame->columns - 1) / frame->columns;
+	frame->tile_height = (frame->height + frame->rows - 1) / frame->rows;
+	atomic_store(&frame->failed, 0);
+	assert(!pthread_barrier_init(&frame->barrier, NULL, workers + 1));
+
+	for (int w = 0; w < workers; w++) {
+		data[w] = (struct worker_data) { .frame = frame, .index = w };
+		assert(!pthread_create(&threads[w], NULL, worker, &data[w]));
+	}
+	pthread_barrier_wait(&frame->barrier);
+
+	for (int f = 0; f <= frame->frames; f++) {
+		atomic_store(&frame->next_tile, 0);
+
+		uint64_t const start = now_ns();
+		pthread_barrier_wait(&frame->barrier);
+		pthread_barrier_wait(&frame->barrier);
+		if (f)
+			total_ns += now_ns() - start;
+
+		/* Nobody was left to take them */
+		if (atomic_load(&frame->next_tile) < count)
+			complete = 0;
+	}
+
+	*busiest = 0;
+	for (int w = 0; w < workers; w++) {
+		pthread_join(threads[w], NULL);
+		if (data[w].tiles > *busiest)
+			*busiest = data[w].tiles;
+	}
+	pthread_barrier_destroy(&frame->barrier);
+	*busiest /= frame->frames + 1;
+
+	return complete ? total_ns / 1e6 / frame->frames : 0;
+}
+
+/* Largest difference in any channel, rounding may differ with the
+ * viewport moved */
+static int compare(const GLubyte *a, const GLubyte *b, size_t size)
+{
+	int max = 0;
+
+	for (size_t i = 0; i < size; i++) {
+		int const diff = abs(a[i] - b[i]);
+
+		if (diff > max)
+			max = diff;
+	}
+
+	return max;
+}
+
+int main(int argc, char **argv)
+{
+	long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_workers = cpus > 0 ? cpus : 4;
+	int columns = 1, rows = 16;
+	int use_devices = 0;
+	char *png = NULL;
+	struct frame frame = { .width = 4096, .height = 4096, .frames = 5 };
+
+	for (int arg = 1; arg < argc; arg++) {
+		if (strncmp(argv[arg], "threads=", 8) == 0)
+			max_workers = atoi(argv[arg] + 8);
+		else if (strncmp(argv[arg], "size=", 5) == 0)
+			sscanf(argv[arg] + 5, "%dx%d", &frame.width, &frame.height);
+		else if (strncmp(argv[arg], "tiles=", 6) == 0)
+			sscanf(argv[arg] + 6, "%dx%d", &columns, &rows);
+		else if (strncmp(argv[arg], "frames=", 7) == 0)
+			frame.frames = atoi(argv[arg] + 7);
+		else if (strcmp(argv[arg], "devices") == 0)
+			use_devices = 1;
+		else if (strncmp(argv[arg], "png=", 4) == 0)
+			png = argv[arg] + 4;
+	}
+	if (max_workers < 1)
+		max_workers = 1;
+	if (max_workers > MAX_WORKERS)
+		max_workers = MAX_WORKERS;
+	if (frame.frames < 1)
+		frame.frames = 1;
+	assert(frame.width > 0 && frame.height > 0);
+	if (columns < 1)
+		columns = 1;
+	if (columns > frame.width)
+		columns = frame.width;
+	if (rows < 1)
+		rows = 1;
+	if (rows > frame.height)
+		rows = frame.height;
+
+	TargetsInit(&frame, use_devices);
+	assert(frame.target_count);
+
+	size_t const size = (size_t) frame.width * frame.height * 4;
+	GLubyte *whole = malloc(size);
+	GLubyte *tiled = malloc(size);
+	assert(whole && tiled);
+
+	printf("%dx%d frame, %dx%d tiles, %d device%s\n", frame.width,
+			frame.height, columns, rows, frame.target_count,
+			frame.target_count > 1 ? "s" : "");
+	printf("%7s %7s %10s %10s %8s %11s %8s\n", "threads", "tiles",
+			"ms/frame", "Mpixel/s", "speedup", "most tiles", "maxdiff");
+
+	/* One context, one framebuffer, nothing cut */
+	int busiest;
+	frame.columns = frame.rows = 1;
+	frame.pixels = whole;
+	double const single = run_frames(&frame, 1, &busiest);
+	if (single)
+		printf("%7s %7d %10.2f %10.1f %7.2fx %11d %8s\n", "whole", 1,
+				single, frame.width * frame.height / single / 1e3,
+				1.0, busiest, "");
+	else
+		printf("%7s failed, comparing to nothing\n", "whole");
+
+	frame.pixels = tiled;
+	frame.columns = columns;
+	frame.rows = rows;
+	for (int workers = 1; ; workers *= 2) {
+		if (workers > max_workers)
+			workers = max_workers;
+
+		memset(tiled, 0, size);
+		double const ms = run_frames(&frame, workers, &busiest);
+
+		if (!ms) {
+			printf("%7d failed\n", workers);
+			break;
+		}
+		printf("%7d %7d %10.2f %10.1f", workers, columns * rows, ms,
+				frame.width * frame.height / ms / 1e3);
+		if (single)
+			printf(" %7.2fx %11d %8d\n", single / ms, busiest,
+					compare(whole, tiled, size));
+		else
+			printf(" %8s %11d %8s\n", "", busiest, "");
+
+		if (workers == max_workers)
+			break;
+	}
+
+	if (png)
+		assert(!writeImage(png, frame.width, frame.height, tiled,
+					"tiles"));
+
+	free(tiled);
+	free(whole);
+	for (int t = 0; t < frame.target_count; t++)
+		eglTerminate(frame.targets[t].display);
+
+	return 0;
+}
@@ -0,0 +1,514 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+
+#include "latency.h"
+
+/* The egl-color scene rendered offscreen by a pool of threads, each with
+ * its own context and framebuffer, all sharing one surfaceless display.
+ * Jobs go to the workers through a lock-free queue, and the pixels they
+ * read back come back through another, in buffers that get recycled
+ * through a third.
+ *
+ * The same jobs run with 1, 2, 4... up to threads= workers, to see how
+ * throughput scales. llvmpipe already spreads each draw over its own
+ * threads, LP_NUM_THREADS=1 takes that out of the picture.
+ *
+ * That's done twice : with every worker compiling the program and
+ * uploading the geometry for itself, and with all contexts in one share
+ * group, a loader context making them once for everybody. share or
+ * noshare only does one. How long until every worker can render and how
+ * much memory that took tell what sharing saves.
+ */
+
+extern EGLDisplay display;
+extern __thread GLuint program;
+
+void InitGLES(int width, int height);
+EGLDisplay OffscreenDisplay(int use_device, int device, EGLConfig *config);
+
+#define MAX_WORKERS 64
+
+/* Bounded multi-producer multi-consumer queue of pointers, after Dmitry
+ * Vyukov's : each cell's sequence number says whether it's ready to be
+ * written or read for the current lap, so producers and consumers only
+ * ever contend on their own end's index. */
+struct queue_cell {
+	atomic_size_t sequence;
+	void *data;
+};
+
+struct job_queue {
+	struct queue_cell *cells;
+	size_t mask;
+	alignas(64) atomic_size_t head;
+	alignas(64) atomic_size_t tail;
+};
+
+struct job {
+	int id;
+	/* sentinel telling a worker to leave */
+	int stop;
+	/* filled in by the worker */
+	GLubyte *pixels;
+	uint64_t render_ns;
+};
+
+struct pool {
+	struct job_queue jobs, results, buffers;
+	EGLConfig config;
+	int width, height;
+	atomic_int ready;
+	atomic_int failed;
+	/* how long workers took to be ready to render, all added up */
+	_Atomic uint64_t setup_ns;
+
+	/* With share, the program and the geometry are made once on the
+	 * loader context, and the fence says when they're there for the
+	 * workers to use */
+	int share;
+	EGLContext loader;
+	GLuint shared_program, shared_vbo;
+	EGLSyncKHR published;
+};
+
+static void queue_init(struct job_queue *q, size_t size)
+{
+	size_t count = 1;
+
+	while (count < size)
+		count *= 2;
+
+	assert((q->cells = calloc(count, sizeof(*q->cells))) != NULL);
+	q->mask = count - 1;
+	for (size_t i = 0; i < count; i++)
+		atomic_init(&q->cells[i].sequence, i);
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+}
+
+static void queue_fini(struct job_queue *q)
+{
+	free(q->cells);
+}
+
+/* 0, or -1 when full */
+static int queue_push(struct job_queue *q, void *data)
+{
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	struct queue_cell *cell;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		size_t const seq =
+			atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t const diff = (intptr_t) seq - (intptr_t) pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->tail, &pos,
+					pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		}
+	}
+
+	cell->data = data;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+	return 0;
+}
+
+/* NULL when empty */
+static void *queue_pop(struct job_queue *q)
+{
+	size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	struct queue_cell *cell;
+	void *data;
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		size_t const seq =
+			atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t const diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos,
+					pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+
+	data = cell->data;
+	atomic_store_explicit(&cell->sequence, pos + q->mask + 1,
+			memory_order_release);
+
+	return data;
+}
+
+/* Nothing to sleep on without a lock, so give the CPU away while waiting */
+static void *queue_pop_wait(struct job_queue *q)
+{
+	void *data;
+
+	while ((data = queue_pop(q)) == NULL)
+		sched_yield();
+
+	return data;
+}
+
+static void queue_push_wait(struct job_queue *q, void *data)
+{
+	while (queue_push(q, data))
+		sched_yield();
+}
+
+static EGLContext CreateContext(EGLConfig config, EGLContext share_context)
+{
+	const EGLint contextAttribs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+	return eglCreateContext(display, config, share_context, contextAttribs);
+}
+
+/* The egl-color triangle, position then color */
+static GLuint CreateGeometry(void)
+{
+	static const GLfloat vertices[] = {
+		-1, -1, 0, 1, 0, 0, 1,
+		-1, 1, 0, 0, 1, 0, 1,
+		1, 1, 0, 0, 0, 1, 1,
+	};
+	GLuint vbo;
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+	return vbo;
+}
+
+/* The triangle, on a background that says which job it was */
+static void Draw(GLuint vbo, int id)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	GLint position = glGetAttribLocation(program, "positionIn");
+	glEnableVertexAttribArray(position);
+	glVertexAttribPointer(position, 3, GL_FLOAT, 0, 7 * sizeof(GLfloat),
+			(void *) 0);
+
+	GLint colorIn = glGetAttribLocation(program, "colorIn");
+	glEnableVertexAttribArray(colorIn);
+	glVertexAttribPointer(colorIn, 4, GL_FLOAT, 0, 7 * sizeof(GLfloat),
+			(void *) (3 * sizeof(GLfloat)));
+
+	glClearColor((id & 0xff) / 255.0, ((id >> 8) & 0xff) / 255.0, 0, 1);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static void *worker(void *data)
+{
+	struct pool *pool = data;
+	uint64_t const start = now_ns();
+	EGLContext context;
+	GLuint texture, fbo, vbo;
+	struct job *job;
+
+	context = CreateContext(pool->config,
+			pool->share ? pool->loader : EGL_NO_CONTEXT);
+	if (context == EGL_NO_CONTEXT ||
+	    !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf(stderr, "Could not create a context : 0x%x\n", eglGetError());
+		atomic_fetch_add(&pool->failed, 1);
+		atomic_fetch_add(&pool->ready, 1);
+		return NULL;
+	}
+
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pool->width, pool->height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, texture, 0);
+	assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+
+	if (pool->share) {
+		if (pool->published != EGL_NO_SYNC_KHR)
+			eglClientWaitSyncKHR(display, pool->published, 0,
+					EGL_FOREVER_KHR);
+		program = pool->shared_program;
+		vbo = pool->shared_vbo;
+		glUseProgram(program);
+		glViewport(0, 0, pool->width, pool->height);
+	} else {
+		/* Shaders compiled now, not while timing */
+		InitGLES(pool->width, pool->height);
+		vbo = CreateGeometry();
+	}
+	atomic_fetch_add(&pool->setup_ns, now_ns() - start);
+	atomic_fetch_add(&pool->ready, 1);
+
+	while (!(job = queue_pop_wait(&pool->jobs))->stop) {
+		uint64_t const t = now_ns();
+
+		job->pixels = queue_pop_wait(&pool->buffers);
+		Draw(vbo, job->id);
+		glReadPixels(0, 0, pool->width, pool->height, GL_RGBA,
+				GL_UNSIGNED_BYTE, job->pixels);
+		job->render_ns = now_ns() - t;
+
+		queue_push_wait(&pool->results, job);
+	}
+
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &texture);
+	if (!pool->share) {
+		glDeleteBuffers(1, &vbo);
+		glDeleteProgram(program);
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglReleaseThread();
+
+	return NULL;
+}
+
+struct run_stats {
+	/* jobs/s, 0 when something went wrong */
+	double rate;
+	/* until every worker could render, and what that took in memory */
+	double startup_ms;
+	double rss_mib;
+	double worker_setup_ms;
+	int bad;
+};
+
+/* Everything the workers will share, made on the main thread */
+static void LoaderInit(struct pool *pool)
+{
+	pool->loader = CreateContext(pool->config, EGL_NO_CONTEXT);
+	assert(pool->loader != EGL_NO_CONTEXT);
+	assert(eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+				pool->loader) == EGL_TRUE);
+
+	InitGLES(pool->width, pool->height);
+	pool->shared_program = program;
+	pool->shared_vbo = CreateGeometry();
+
+	pool->published = EGL_NO_SYNC_KHR;
+	if (epoxy_has_egl_extension(display, "EGL_KHR_fence_sync"))
+		pool->published = eglCreateSyncKHR(display, EGL_SYNC_FENCE_KHR, NULL);
+	if (pool->published != EGL_NO_SYNC_KHR)
+		glFlush();
+	else
+		glFinish();
+}
+
+static void LoaderFini(struct pool *pool)
+{
+	if (pool->published != EGL_NO_SYNC_KHR)
+		eglDestroySyncKHR(display, pool->published);
+	glDeleteBuffers(1, &pool->shared_vbo);
+	glDeleteProgram(pool->shared_program);
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, pool->loader);
+}
+
+static void run_pool(struct pool *pool, int workers, struct job *jobs,
+		int count, struct run_stats *stats)
+{
+	pthread_t threads[MAX_WORKERS];
+	struct job stop = { .stop = 1 };
+	int started = 0, done = 0;
+	long const rss = process_memory("VmRSS");
+	uint64_t const setup_start = now_ns();
+
+	atomic_store(&pool->ready, 0);
+	atomic_store(&pool->failed, 0);
+	atomic_store(&pool->setup_ns, 0);
+	if (pool->share)
+		LoaderInit(pool);
+	for (; started < workers; started++)
+		if (pthread_create(&threads[started], NULL, worker, pool))
+			break;
+
+	while (atomic_load(&pool->ready) < started)
+		sched_yield();
+
+	stats->startup_ms = (now_ns() - setup_start) / 1e6;
+	stats->rss_mib = ((long)process_memory("VmRSS") - rss) / 1024.0;
+	stats->worker_setup_ms = atomic_load(&pool->setup_ns) / 1e6 / started;
+	stats->bad = 0;
+
+	uint64_t const start = now_ns();
+
+	/* Feed them while taking results, the job queue is smaller than the
+	 * job list */
+	for (int submitted = 0; done < count; ) {
+		struct job *job;
+
+		if (atomic_load(&pool->failed) == started)
+			break;
+
+		if (submitted < count && !queue_push(&pool->jobs, &jobs[submitted])) {
+			submitted++;
+			continue;
+		}
+
+		job = queue_pop(&pool->results);
+		if (!job) {
+			sched_yield();
+			continue;
+		}
+
+		/* The bottom right corner is background, in the job's color */
+		GLubyte const *pixel =
+			job->pixels + ((size_t) pool->width - 1) * 4;
+		if (pixel[0] != (job->id & 0xff) ||
+		    pixel[1] != ((job->id >> 8) & 0xff))
+			stats->bad++;
+		queue_push_wait(&pool->buffers, job->pixels);
+		done++;
+	}
+
+	double const seconds = (now_ns() - start) / 1e9;
+
+	/* Those that couldn't get a context already left */
+	int const alive = started - atomic_load(&pool->failed);
+	for (int w = 0; w < alive; w++)
+		queue_push_wait(&pool->jobs, &stop);
+	for (int w = 0; w < started; w++)
+		pthread_join(threads[w], NULL);
+	if (pool->share)
+		LoaderFini(pool);
+
+	stats->rate = done == count ? count / seconds : 0;
+}
+
+int main(int argc, char **argv)
+{
+	long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int max_workers = cpus > 0 ? cpus : 4;
+	int count = 2000;
+	struct pool pool = { .width = 256, .height = 256 };
+	struct {
+		int separate, shared;
+	} modes = { 1, 1 };
+
+	for (int arg = 1; arg < argc; arg++) {
+		if (strncmp(argv[arg], "threads=", 8) == 0)
+			max_workers = atoi(argv[arg] + 8);
+		else if (strncmp(argv[arg], "jobs=", 5) == 0)
+			count = atoi(argv[arg] + 5);
+		else if (strncmp(argv[arg], "size=", 5) == 0)
+			sscanf(argv[arg] + 5, "%dx%d", &pool.width, &pool.height);
+		else if (strcmp(argv[arg], "share") == 0)
+			modes.separate = 0;
+		else if (strcmp(argv[arg], "noshare") == 0)
+			modes.shared = 0;
+	}
+	if (max_workers < 1)
+		max_workers = 1;
+	if (max_workers > MAX_WORKERS)
+		max_workers = MAX_WORKERS;
+	if (count < 1)
+		count = 1;
+
+	assert((display = OffscreenDisplay(0, -1, &pool.config)) != EGL_NO_DISPLAY);
+
+	/* Twice as many buffers as workers keeps them all busy while the
+	 * main thread checks results */
+	int const buffer_count = max_workers * 2;
+	GLubyte *pixels = malloc((size_t) buffer_count * pool.width * pool.height * 4);
+	struct job *jobs = calloc(count, sizeof(*jobs));
+
+	assert(pixels && jobs);
+	queue_init(&pool.jobs, 256);
+	queue_init(&pool.results, count < 256 ? 256 : count);
+	queue_init(&pool.buffers, buffer_count);
+
+	printf("%d jobs of %dx%d\n", count, pool.width, pool.height);
+
+	for (int share = 0; share < 2; share++) {
+		if ((share && !modes.shared) || (!share && !modes.separate))
+			continue;
+		pool.share = share;
+
+		printf("\n%s\n", share ?
+				"one share group, program and geometry made once" :
+				"separate contexts, each making its own");
+		printf("%7s %10s %8s %10s %10s %11s %11s %9s\n", "threads", "jobs/s",
+				"speedup", "efficiency", "ms per job", "startup ms",
+				"worker ms", "rss MiB");
+
+		double single = 0;
+		for (int workers = 1; ; workers *= 2) {
+			struct run_stats stats;
+
+			if (workers > max_workers)
+				workers = max_workers;
+
+			for (int b = 0; b < buffer_count; b++)
+				queue_push_wait(&pool.buffers,
+						pixels + (size_t) b * pool.width * pool.height * 4);
+			for (int j = 0; j < count; j++)
+				jobs[j] = (struct job) { .id = j };
+
+			run_pool(&pool, workers, jobs, count, &stats);
+
+			while (queue_pop(&pool.buffers))
+				;
+
+			if (stats.rate == 0) {
+				printf("%7d failed\n", workers);
+				break;
+			}
+			uint64_t render_ns = 0;
+			for (int j = 0; j < count; j++)
+				render_ns += jobs[j].render_ns;
+
+			if (workers == 1)
+				single = stats.rate;
+			printf("%7d %10.1f %7.2fx %9.0f%% %10.3f %11.2f %11.2f %9.1f%s\n",
+					workers, stats.rate, stats.rate / single,
+					stats.rate / single / workers * 100,
+					render_ns / 1e6 / count, stats.startup_ms,
+					stats.worker_setup_ms, stats.rss_mib,
+					stats.bad ? " (wrong pixels)" : "");
+
+			if (workers == max_workers)
+				break;
+		}
+	}
+
+	queue_fini(&pool.jobs);
+	queue_fini(&pool.results);
+	queue_fini(&pool.buffers);
+	free(jobs);
+	free(pixels);
+	eglTerminate(display);
+
+	return 0;
+}
@@ -10,7 +10,7 @@
 #include <X11/Xlib.h>
 
 extern EGLDisplay display;
-extern EGLSurface surface;
+extern __thread EGLSurface surface;
 
 #define TARGET_SIZE 256
 
@@ -1,16 +1,22 @@
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <png.h>
 
-GLuint program;
+/* The program and surface are per thread, so that several threads can
+ * each render the scene with their own context. */
+__thread GLuint program;
 EGLDisplay display;
-EGLSurface surface;
+__thread EGLSurface surface;
 
-static GLuint LoadShader(const char *name, GLenum type)
+/* Compiled from the file, 0 when it can't be read or doesn't compile */
+GLuint LoadShader(const char *name, GLenum type)
 {
 	FILE *f;
 	int size;
@@ -19,7 +25,10 @@ static GLuint LoadShader(const char *name, GLenum type)
 	GLint compiled;
 	const GLchar *source[1];
 
-	assert((f = fopen(name, "r")) != NULL);
+	if ((f = fopen(name, "r")) == NULL) {
+		fprintf(stderr, "Could not open %s : %s\n", name, strerror(errno));
+		return 0;
+	}
 
 	// get file size
 	fseek(f, 0, SEEK_END);
@@ -27,7 +36,7 @@ static GLuint LoadShader(const char *name, GLenum type)
 	fseek(f, 0, SEEK_SET);
 
 	assert((buff = malloc(size)) != NULL);
-	assert(fread(buff, 1, size, f) == size);
+	assert(fread(buff, 1, size, f) == (size_t) size);
 	source[0] = buff;
 	fclose(f);
 	shader = glCreateShader(type);
@@ -113,7 +122,6 @@ void Render(void)
 	glClear(GL_COLOR_BUFFER_BIT
 			//| GL_DEPTH_BUFFER_BIT
 	       );
-	printf("%x\n", glGetError());
 	assert(glGetError() == GL_NO_ERROR);
 
 	//glDrawElements(GL_TRIANGLES, sizeof(index)/sizeof(GLuint), GL_UNSIGNED_INT, index);
@@ -123,3 +131,184 @@ void Render(void)
 
 	eglSwapBuffers(display, surface);
 }
+
+static int HasExtension(EGLDisplay dpy, const char *name)
+{
+	const char *extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+	size_t const len = strlen(name);
+
+	for (const char *e = extensions; e && (e = strstr(e, name)); e += len)
+		if ((e == extensions || e[-1] == ' ') &&
+		    (e[len] == ' ' || e[len] == '\0'))
+			return 1;
+
+	return 0;
+}
+
+/* How many EGL devices there are, 0 without device enumeration */
+int OffscreenDeviceCount(void)
+{
+	PFNEGLQUERYDEVICESEXTPROC query_devices = (PFNEGLQUERYDEVICESEXTPROC)
+		eglGetProcAddress("eglQueryDevicesEXT");
+	EGLint num_devices;
+
+	if (!HasExtension(EGL_NO_DISPLAY, "EGL_EXT_device_enumeration") ||
+	    !query_devices || !query_devices(0, NULL, &num_devices))
+		return 0;
+
+	return num_devices;
+}
+
+/* A display to render offscreen on, without a window system : the
+ * surfaceless platform, or with use_device or when there's no such
+ * platform, EGL device number device. -1 is the software one when there
+ * is one, or else the first. It comes initialized, with a config for ES 2
+ * contexts made current without surfaces. EGL_NO_DISPLAY when none of
+ * that works. */
+EGLDisplay OffscreenDisplay(int use_device, int device, EGLConfig *config)
+{
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)
+		eglGetProcAddress("eglGetPlatformDisplayEXT");
+	PFNEGLQUERYDEVICESEXTPROC query_devices = (PFNEGLQUERYDEVICESEXTPROC)
+		eglGetProcAddress("eglQueryDevicesEXT");
+	PFNEGLQUERYDEVICESTRINGEXTPROC query_device_string =
+		(PFNEGLQUERYDEVICESTRINGEXTPROC)
+		eglGetProcAddress("eglQueryDeviceStringEXT");
+	EGLDisplay dpy = EGL_NO_DISPLAY;
+	const char *platform = "surfaceless";
+
+	if (!get_platform_display)
+		return EGL_NO_DISPLAY;
+
+	if (!use_device &&
+	    HasExtension(EGL_NO_DISPLAY, "EGL_MESA_platform_surfaceless"))
+		dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+				EGL_DEFAULT_DISPLAY, NULL);
+
+	if (dpy == EGL_NO_DISPLAY &&
+	    HasExtension(EGL_NO_DISPLAY, "EGL_EXT_platform_device")) {
+		EGLDeviceEXT devices[16];
+		EGLint num_devices = 0;
+
+		platform = "device";
+		if (OffscreenDeviceCount())
+			query_devices(16, devices, &num_devices);
+
+		// Rather the software one, that's the one every machine has.
+		for (int i = 0; i < num_devices && device < 0; i++) {
+			const char *extensions =
+				query_device_string(devices[i], EGL_EXTENSIONS);
+
+			if (extensions && strstr(extensions, "EGL_MESA_device_software"))
+				device = i;
+		}
+		if (device < 0)
+			device = 0;
+
+		if (device < num_devices)
+			dpy = get_platform_display(EGL_PLATFORM_DEVICE_EXT,
+					devices[device], NULL);
+	}
+
+	EGLint majorVersion;
+	EGLint minorVersion;
+	if (dpy == EGL_NO_DISPLAY ||
+	    !eglInitialize(dpy, &majorVersion, &minorVersion))
+		return EGL_NO_DISPLAY;
+
+	// No surfaces, so any config will do.
+	EGLint egl_config_attribs[] = {
+		EGL_RENDERABLE_TYPE,	EGL_OPENGL_ES2_BIT,
+		EGL_SURFACE_TYPE,	EGL_DONT_CARE,
+		EGL_NONE,
+	};
+	EGLint num_configs;
+	if (!HasExtension(dpy, "EGL_KHR_surfaceless_context") ||
+	    !eglChooseConfig(dpy, egl_config_attribs, config, 1, &num_configs) ||
+	    !num_configs) {
+		eglTerminate(dpy);
+		return EGL_NO_DISPLAY;
+	}
+	eglBindAPI(EGL_OPENGL_ES_API);
+
+	printf("%s platform : %s, %s\n", platform,
+			eglQueryString(dpy, EGL_VENDOR),
+			eglQueryString(dpy, EGL_VERSION));
+
+	return dpy;
+}
+
+/* Where the programs without a window save what they drew : RGBA rows,
+ * as glReadPixels returns them, to a PNG file */
+int writeImage(char* filename, int width, int height, void *buffer, char* title)
+{
+	int code = 0;
+	FILE *fp = NULL;
+	png_structp png_ptr = NULL;
+	png_infop info_ptr = NULL;
+
+	// Open file for writing (binary mode)
+	fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		fprintf(stderr, "Could not open file %s for writing\n", filename);
+		code = 1;
+		goto finalise;
+	}
+
+	// Initialize write structure
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (png_ptr == NULL) {
+		fprintf(stderr, "Could not allocate write struct\n");
+		code = 1;
+		goto finalise;
+	}
+
+	// Initialize info structure
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		fprintf(stderr, "Could not allocate info struct\n");
+		code = 1;
+		goto finalise;
+	}
+
+	// Setup Exception handling
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		fprintf(stderr, "Error during png creation\n");
+		code = 1;
+		goto finalise;
+	}
+
+	png_init_io(png_ptr, fp);
+
+	// Write header (8 bit colour depth)
+	png_set_IHDR(png_ptr, info_ptr, width, height,
+			8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+	// Set title
+	if (title != NULL) {
+		png_text title_text;
+		title_text.compression = PNG_TEXT_COMPRESSION_NONE;
+		title_text.key = "Title";
+		title_text.text = title;
+		png_set_text(png_ptr, info_ptr, &title_text, 1);
+	}
+
+	png_write_info(png_ptr, info_ptr);
+
+	// Write image data
+	int i;
+	for (i = 0; i < height; i++)
+		png_write_row(png_ptr, (png_bytep)buffer + i * width * 4);
+
+	// End write
+	png_write_end(png_ptr, NULL);
+
+finalise:
+	if (fp != NULL) fclose(fp);
+	if (info_ptr != NULL) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
+	if (png_ptr != NULL) png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+
+	return code;
+}
@@ -32,6 +32,8 @@
 #include <errno.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include <gbm.h>
 #include <epoxy/gl.h>
@@ -40,8 +42,10 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 EGLDisplay display;
 EGLContext context;
@@ -54,8 +58,15 @@ struct kms {
    uint32_t fb_id;
 };
 
+/*
+ * drmModeGetConnector makes the kernel probe the connector, which usually
+ * means reading the EDID over DDC and can take hundreds of milliseconds per
+ * connector.  With fast set we only ask for the state the kernel already
+ * has (drmModeGetConnectorCurrent), and fall back to a real probe only for
+ * connectors that were never probed before.
+ */
 static EGLBoolean
-setup_kms(int fd, struct kms *kms)
+setup_kms(int fd, struct kms *kms, int fast)
 {
    drmModeRes *resources = NULL;
    drmModeConnector *connector = NULL;
@@ -69,7 +80,15 @@ setup_kms(int fd, struct kms *kms)
    }
 
    for (i = 0; i < resources->count_connectors; i++) {
-      connector = drmModeGetConnector(fd, resources->connectors[i]);
+      connector = NULL;
+      if (fast)
+         connector = drmModeGetConnectorCurrent(fd, resources->connectors[i]);
+      if (connector == NULL ||
+          (connector->connection != DRM_MODE_DISCONNECTED &&
+           connector->count_modes == 0)) {
+         drmModeFreeConnector(connector);
+         connector = drmModeGetConnector(fd, resources->connectors[i]);
+      }
       if (connector == NULL)
          continue;
 
@@ -81,26 +100,184 @@ setup_kms(int fd, struct kms *kms)
 
    if (i == resources->count_connectors) {
       fprintf(stderr, "No currently active connector found.\n");
+      drmModeFreeResources(resources);
       return EGL_FALSE;
    }
 
-   for (i = 0; i < resources->count_encoders; i++) {
-      encoder = drmModeGetEncoder(fd, resources->encoders[i]);
+   encoder = drmModeGetEncoder(fd, connector->encoder_id);
+   if (encoder == NULL) {
+      fprintf(stderr, "No encoder for connector %u.\n", connector->connector_id);
+      drmModeFreeConnector(connector);
+      drmModeFreeResources(resources);
+      return EGL_FALSE;
+   }
 
-      if (encoder == NULL)
-         continue;
+   kms->connector = connector;
+   kms->encoder = encoder;
+   kms->mode = connector->modes[0];
 
-      if (encoder->encoder_id == connector->encoder_id)
-         break;
+   drmModeFreeResources(resources);
+
+   return EGL_TRUE;
+}
+
+/*
+ * The connector/CRTC/mode picked by setup_kms is cached on disk, keyed by
+ * the device number of the DRM node, so a warm start only has to check
+ * that the cached connector is still connected and driven the same way.
+ */
+
+#define KMS_CACHE_MAGIC 0x314b4d53 /* "SMK1" */
+
+struct kms_cache {
+   uint32_t magic;
+   uint32_t connector_id;
+   uint32_t encoder_id;
+   uint32_t crtc_id;
+   drmModeModeInfo mode;
+};
+
+static void
+kms_cache_path(int fd, char *path, size_t size)
+{
+   const char *dir = getenv("XDG_CACHE_HOME");
+   struct stat st;
+
+   if (fstat(fd, &st))
+      st.st_rdev = 0;
+
+   snprintf(path, size, "%s/kms-%u-%u.cache", dir ? dir : "/var/tmp",
+            major(st.st_rdev), minor(st.st_rdev));
+}
+
+static EGLBoolean
+setup_kms_cached(int fd, struct kms *kms, const char *path)
+{
+   drmModeConnector *connector;
+   drmModeEncoder *encoder;
+   struct kms_cache cache;
+   int i, found;
+   FILE *f;
+
+   f = fopen(path, "rb");
+   if (f == NULL)
+      return EGL_FALSE;
+   found = fread(&cache, sizeof cache, 1, f) == 1 && cache.magic == KMS_CACHE_MAGIC;
+   fclose(f);
+   if (!found)
+      return EGL_FALSE;
+
+   connector = drmModeGetConnectorCurrent(fd, cache.connector_id);
+   if (connector == NULL)
+      return EGL_FALSE;
 
+   if (connector->connection != DRM_MODE_CONNECTED ||
+       connector->encoder_id != cache.encoder_id)
+      goto free_connector;
+
+   /* the kernel may not have a mode list yet, then trust the cache */
+   found = connector->count_modes == 0;
+   for (i = 0; i < connector->count_modes && !found; i++)
+      found = memcmp(&connector->modes[i], &cache.mode, sizeof cache.mode) == 0;
+   if (!found)
+      goto free_connector;
+
+   encoder = drmModeGetEncoder(fd, cache.encoder_id);
+   if (encoder == NULL)
+      goto free_connector;
+   if (encoder->crtc_id != cache.crtc_id) {
       drmModeFreeEncoder(encoder);
+      goto free_connector;
    }
 
    kms->connector = connector;
    kms->encoder = encoder;
-   kms->mode = connector->modes[0];
+   kms->mode = cache.mode;
 
    return EGL_TRUE;
+
+free_connector:
+   drmModeFreeConnector(connector);
+   return EGL_FALSE;
+}
+
+static void
+kms_cache_save(struct kms *kms, const char *path)
+{
+   struct kms_cache cache = {
+      .magic = KMS_CACHE_MAGIC,
+      .connector_id = kms->connector->connector_id,
+      .encoder_id = kms->encoder->encoder_id,
+      .crtc_id = kms->encoder->crtc_id,
+      .mode = kms->mode,
+   };
+   FILE *f;
+
+   f = fopen(path, "wb");
+   if (f == NULL || fwrite(&cache, sizeof cache, 1, f) != 1)
+      fprintf(stderr, "failed to write kms cache %s\n", path);
+   if (f)
+      fclose(f);
+}
+
+/*
+ * Takeover: when the CRTC already runs the mode we want, skip the full
+ * modeset (several frames of blanking) and just flip our framebuffer in,
+ * and the saved one back in on exit.
+ */
+static int
+mode_equal(const drmModeModeInfo *a, const drmModeModeInfo *b)
+{
+   return a->clock == b->clock &&
+          a->hdisplay == b->hdisplay &&
+          a->hsync_start == b->hsync_start &&
+          a->hsync_end == b->hsync_end &&
+          a->htotal == b->htotal &&
+          a->hskew == b->hskew &&
+          a->vdisplay == b->vdisplay &&
+          a->vsync_start == b->vsync_start &&
+          a->vsync_end == b->vsync_end &&
+          a->vtotal == b->vtotal &&
+          a->vscan == b->vscan &&
+          a->flags == b->flags;
+}
+
+static void
+page_flip_handler(int fd, unsigned int frame,
+                  unsigned int sec, unsigned int usec, void *data)
+{
+   int *waiting_for_flip = data;
+
+   (void)fd; (void)frame; (void)sec; (void)usec;
+   *waiting_for_flip = 0;
+}
+
+static int
+flip_to(int fd, uint32_t crtc_id, uint32_t fb_id)
+{
+   drmEventContext evctx = {
+      .version = 2,
+      .page_flip_handler = page_flip_handler,
+   };
+   struct pollfd pfd = {
+      .fd = fd,
+      .events = POLLIN,
+   };
+   int waiting_for_flip = 1;
+
+   if (drmModePageFlip(fd, crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT,
+                       &waiting_for_flip)) {
+      fprintf(stderr, "failed to flip to fb %u: %m\n", fb_id);
+      return -1;
+   }
+
+   while (waiting_for_flip) {
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+         return -1;
+      drmHandleEvent(fd, &evctx);
+   }
+
+   return 0;
 }
 
 GLuint program;
@@ -244,6 +421,18 @@ int main(int argc, char *argv[])
    struct gbm_bo *bo;
    drmModeCrtcPtr saved_crtc;
    struct gbm_surface *gs;
+   struct timespec start, end;
+   int i, fast = 0, cache = 0, takeover = 0, seamless;
+   char cache_path[256];
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "fast") == 0)
+         fast = 1;
+      else if (strcmp(argv[i], "cache") == 0)
+         cache = fast = 1;
+      else if (strcmp(argv[i], "takeover") == 0)
+         takeover = 1;
+   }
 
    fd = open(device_name, O_RDWR);
    if (fd < 0) {
@@ -275,10 +464,20 @@ int main(int argc, char *argv[])
    ver = eglQueryString(display, EGL_VERSION);
    printf("EGL_VERSION = %s\n", ver);
 
-   if (!setup_kms(fd, &kms)) {
-      ret = -1;
-      goto egl_terminate;
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   kms_cache_path(fd, cache_path, sizeof cache_path);
+   if (!cache || !setup_kms_cached(fd, &kms, cache_path)) {
+      if (!setup_kms(fd, &kms, fast)) {
+         ret = -1;
+         goto egl_terminate;
+      }
+      if (cache)
+         kms_cache_save(&kms, cache_path);
    }
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   printf("setup_kms: connector %u, crtc %u, %s, %.3f ms\n",
+          kms.connector->connector_id, kms.encoder->crtc_id, kms.mode.name,
+          (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
 
    eglBindAPI(EGL_OPENGL_ES_API);
 
@@ -331,8 +530,17 @@ int main(int argc, char *argv[])
    if (saved_crtc == NULL)
       goto rm_fb;
 
-   ret = drmModeSetCrtc(fd, kms.encoder->crtc_id, kms.fb_id, 0, 0,
-         &kms.connector->connector_id, 1, &kms.mode);
+   seamless = takeover && saved_crtc->mode_valid && saved_crtc->buffer_id &&
+              mode_equal(&saved_crtc->mode, &kms.mode);
+   if (takeover)
+      printf("takeover: %s\n", seamless ? "mode matches, skipping the modeset" :
+                                          "mode differs, doing a full modeset");
+
+   if (seamless)
+      ret = flip_to(fd, kms.encoder->crtc_id, kms.fb_id);
+   else
+      ret = drmModeSetCrtc(fd, kms.encoder->crtc_id, kms.fb_id, 0, 0,
+            &kms.connector->connector_id, 1, &kms.mode);
    if (ret) {
       fprintf(stderr, "failed to set mode: %m\n");
       goto free_saved_crtc;
@@ -340,9 +548,10 @@ int main(int argc, char *argv[])
 
    getchar();
 
-   ret = drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
-                        saved_crtc->x, saved_crtc->y,
-                        &kms.connector->connector_id, 1, &saved_crtc->mode);
+   if (!seamless || flip_to(fd, saved_crtc->crtc_id, saved_crtc->buffer_id))
+      ret = drmModeSetCrtc(fd, saved_crtc->crtc_id, saved_crtc->buffer_id,
+                           saved_crtc->x, saved_crtc->y,
+                           &kms.connector->connector_id, 1, &saved_crtc->mode);
    if (ret) {
       fprintf(stderr, "failed to restore crtc: %m\n");
    }
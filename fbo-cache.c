@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/stat.h>
+
+#include "fbo-cache.h"
+
+struct fbo_cache {
+	EGLDisplay dpy;
+	int max_entries;
+
+	/* few entries, most recently used first */
+	struct cached_fbo *entries;
+	int count;
+
+	uint64_t hits, misses, evicted;
+};
+
+int fbo_create(EGLDisplay dpy, struct gbm_bo *bo, struct cached_fbo *target)
+{
+	target->width = gbm_bo_get_width(bo);
+	target->height = gbm_bo_get_height(bo);
+
+	target->image = eglCreateImageKHR(dpy, EGL_NO_CONTEXT,
+			EGL_NATIVE_PIXMAP_KHR, bo, NULL);
+	if (target->image == EGL_NO_IMAGE_KHR) {
+		fprintf(stderr, "eglCreateImageKHR failed: 0x%x\n", eglGetError());
+		return -1;
+	}
+
+	glGenFramebuffers(1, &target->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+
+	glGenRenderbuffers(1, &target->color_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->color_rb);
+	glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER, target->image);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_RENDERBUFFER, target->color_rb);
+
+	glGenRenderbuffers(1, &target->depth_rb);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->depth_rb);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+			target->width, target->height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+			GL_RENDERBUFFER, target->depth_rb);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "framebuffer for a %ux%u bo is incomplete\n",
+				target->width, target->height);
+		fbo_destroy(dpy, target);
+		return -1;
+	}
+
+	return 0;
+}
+
+void fbo_destroy(EGLDisplay dpy, struct cached_fbo *target)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &target->fbo);
+	glDeleteRenderbuffers(1, &target->color_rb);
+	glDeleteRenderbuffers(1, &target->depth_rb);
+	eglDestroyImageKHR(dpy, target->image);
+	target->fbo = target->color_rb = target->depth_rb = 0;
+	target->image = EGL_NO_IMAGE_KHR;
+}
+
+struct fbo_cache *fbo_cache_create(EGLDisplay dpy, int max_entries)
+{
+	struct fbo_cache *cache = calloc(1, sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+
+	cache->dpy = dpy;
+	cache->max_entries = max_entries > 0 ? max_entries : 1;
+
+	return cache;
+}
+
+static void evict(struct fbo_cache *cache, struct cached_fbo **link)
+{
+	struct cached_fbo *target = *link;
+
+	*link = target->next;
+	fbo_destroy(cache->dpy, target);
+	free(target);
+	cache->count--;
+}
+
+void fbo_cache_destroy(struct fbo_cache *cache)
+{
+	while (cache->entries)
+		evict(cache, &cache->entries);
+	free(cache);
+}
+
+static struct cached_fbo **find(struct fbo_cache *cache,
+		const struct stat *st)
+{
+	struct cached_fbo **link;
+
+	for (link = &cache->entries; *link; link = &(*link)->next)
+		if ((*link)->ino == st->st_ino && (*link)->dev == st->st_dev)
+			return link;
+
+	return NULL;
+}
+
+struct cached_fbo *fbo_cache_get(struct fbo_cache *cache, int dma_buf_fd,
+		struct gbm_bo *bo)
+{
+	struct cached_fbo **link, *target;
+	struct stat st;
+
+	/* Without an inode there is nothing to key the entry on */
+	if (fstat(dma_buf_fd, &st)) {
+		fprintf(stderr, "fstat on dma-buf fd %d failed: %m\n", dma_buf_fd);
+		return NULL;
+	}
+
+	link = find(cache, &st);
+	if (link) {
+		/* Move it to the front, that's where we look first */
+		target = *link;
+		*link = target->next;
+		target->next = cache->entries;
+		cache->entries = target;
+		cache->hits++;
+		return target;
+	}
+
+	cache->misses++;
+
+	target = calloc(1, sizeof(*target));
+	if (!target)
+		return NULL;
+
+	if (fbo_create(cache->dpy, bo, target)) {
+		free(target);
+		return NULL;
+	}
+	target->dev = st.st_dev;
+	target->ino = st.st_ino;
+
+	/* Full : the least recently used one is at the end */
+	if (cache->count == cache->max_entries) {
+		link = &cache->entries;
+		while ((*link)->next)
+			link = &(*link)->next;
+		evict(cache, link);
+		cache->evicted++;
+	}
+
+	target->next = cache->entries;
+	cache->entries = target;
+	cache->count++;
+
+	return target;
+}
+
+struct cached_fbo *fbo_cache_bind(struct fbo_cache *cache, int dma_buf_fd,
+		struct gbm_bo *bo)
+{
+	struct cached_fbo *target = fbo_cache_get(cache, dma_buf_fd, bo);
+
+	if (!target)
+		return NULL;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+	glViewport(0, 0, target->width, target->height);
+
+	return target;
+}
+
+void fbo_cache_forget(struct fbo_cache *cache, int dma_buf_fd)
+{
+	struct cached_fbo **link;
+	struct stat st;
+
+	if (fstat(dma_buf_fd, &st))
+		return;
+
+	link = find(cache, &st);
+	if (link)
+		evict(cache, link);
+}
+
+void fbo_cache_get_stats(struct fbo_cache *cache,
+		struct fbo_cache_stats *stats)
+{
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evicted = cache->evicted;
+	stats->count = cache->count;
+}
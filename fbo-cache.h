@@ -0,0 +1,62 @@
+#ifndef FBO_CACHE_H
+#define FBO_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <gbm.h>
+#include <epoxy/gl.h>
+#include <epoxy/egl.h>
+
+/* Importing a buffer as a render target means an EGLImage, a color
+ * renderbuffer backed by it, a depth renderbuffer and a framebuffer object
+ * to tie them, plus a completeness check. Do that once per buffer, and
+ * switching targets is a glBindFramebuffer.
+ *
+ * Buffers are told apart by their dma-buf inode, which stays the same
+ * however many times the buffer gets exported, imported or its fd
+ * duplicated. */
+struct cached_fbo {
+	dev_t dev;
+	ino_t ino;
+
+	EGLImageKHR image;
+	GLuint fbo;
+	GLuint color_rb;
+	GLuint depth_rb;
+	uint32_t width, height;
+
+	struct cached_fbo *next;
+};
+
+struct fbo_cache_stats {
+	uint64_t hits, misses, evicted;
+	int count;
+};
+
+struct fbo_cache;
+
+/* Holds at most max_entries targets, dropping the least recently used.
+ * Needs the context that will render to them to be current. */
+struct fbo_cache *fbo_cache_create(EGLDisplay dpy, int max_entries);
+void fbo_cache_destroy(struct fbo_cache *cache);
+
+/* The target for the buffer behind dma_buf_fd, made from bo the first
+ * time it's seen. */
+struct cached_fbo *fbo_cache_get(struct fbo_cache *cache, int dma_buf_fd,
+                                 struct gbm_bo *bo);
+/* Get and bind it, with a viewport covering it */
+struct cached_fbo *fbo_cache_bind(struct fbo_cache *cache, int dma_buf_fd,
+                                  struct gbm_bo *bo);
+/* Drop the target of a buffer about to be destroyed */
+void fbo_cache_forget(struct fbo_cache *cache, int dma_buf_fd);
+
+void fbo_cache_get_stats(struct fbo_cache *cache,
+                         struct fbo_cache_stats *stats);
+
+/* What the cache saves, for comparison: build a target from scratch, and
+ * tear it down. */
+int fbo_create(EGLDisplay dpy, struct gbm_bo *bo, struct cached_fbo *target);
+void fbo_destroy(EGLDisplay dpy, struct cached_fbo *target);
+
+#endif
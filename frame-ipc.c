@@ -0,0 +1,88 @@
+#include <errno.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "frame-ipc.h"
+
+int frame_msg_send(int sock, const struct frame_msg *msg, int fd)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {
+		.iov_base = (void *) msg,
+		.iov_len = sizeof(*msg)
+	};
+	struct msghdr header = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1
+	};
+	ssize_t sent;
+
+	if (fd >= 0) {
+		struct cmsghdr *cmsg;
+
+		memset(&control, 0, sizeof(control));
+		header.msg_control = control.buf;
+		header.msg_controllen = sizeof(control.buf);
+		cmsg = CMSG_FIRSTHDR(&header);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	do {
+		sent = sendmsg(sock, &header, MSG_NOSIGNAL);
+	} while (sent < 0 && errno == EINTR);
+
+	return sent == sizeof(*msg) ? 0 : -1;
+}
+
+int frame_msg_recv(int sock, struct frame_msg *msg, int *fd)
+{
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {
+		.iov_base = msg,
+		.iov_len = sizeof(*msg)
+	};
+	struct msghdr header = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf)
+	};
+	ssize_t received;
+
+	*fd = -1;
+	memset(&control, 0, sizeof(control));
+
+	do {
+		received = recvmsg(sock, &header, MSG_CMSG_CLOEXEC);
+	} while (received < 0 && errno == EINTR);
+
+	/* The control buffer wasn't filled in then */
+	if (received < 0)
+		return -1;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header); cmsg;
+	     cmsg = CMSG_NXTHDR(&header, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+
+	if (received != sizeof(*msg) || header.msg_flags & MSG_CTRUNC) {
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef FRAME_IPC_H
+#define FRAME_IPC_H
+
+#include <stdint.h>
+
+/* What dmabuf-producer and dmabuf-consumer say to each other over a
+ * SOCK_SEQPACKET Unix socket, one message per packet. File descriptors
+ * ride along with SCM_RIGHTS :
+ *
+ * - FRAME_MSG_BUFFER, producer to consumer, once per buffer : its dma-buf,
+ *   and how to read it
+ * - FRAME_MSG_FRAME, producer to consumer : a buffer has a new frame,
+ *   with a sync_file fence that signals once rendering is done, or no fd
+ *   when the producer already waited
+ * - FRAME_MSG_RELEASE, consumer to producer : done with the frame, the
+ *   buffer can be rendered to again
+ * - FRAME_MSG_DONE, producer to consumer : no more frames
+ */
+
+#define FRAME_IPC_SOCKET "/tmp/dmabuf-handoff.sock"
+
+enum frame_msg_type {
+	FRAME_MSG_BUFFER,
+	FRAME_MSG_FRAME,
+	FRAME_MSG_RELEASE,
+	FRAME_MSG_DONE,
+};
+
+struct frame_msg {
+	uint32_t type;
+	uint32_t buffer;
+
+	/* FRAME_MSG_BUFFER */
+	uint32_t width, height;
+	uint32_t format;
+	uint32_t stride, offset;
+	uint64_t modifier;
+
+	/* FRAME_MSG_FRAME and FRAME_MSG_RELEASE, which echoes them back */
+	uint64_t frame;
+	/* CLOCK_MONOTONIC, the same in both processes */
+	uint64_t sent_ns;
+};
+
+/* Pass fd -1 to send no file descriptor. Returns 0 on success. */
+int frame_msg_send(int sock, const struct frame_msg *msg, int fd);
+/* *fd is -1 when none came along. Returns 0 on success, -1 on error or
+ * when the other side went away. */
+int frame_msg_recv(int sock, struct frame_msg *msg, int *fd);
+
+#endif
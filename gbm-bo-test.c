@@ -3,10 +3,13 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include <gbm.h>
 #include <png.h>
@@ -16,6 +19,12 @@
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "bo-pool.h"
+#include "fbo-cache.h"
+#include "latency.h"
+#include "modifiers.h"
 
 GLuint program;
 
@@ -194,16 +203,992 @@ static void dump_mode(drmModeModeInfo *mode)
 	printf("\n");
 }
 
+/* Allocate a few buffers of the sizes a compositor keeps asking for, then
+ * let them all go, over and over, timing every allocation: once with the
+ * whole gbm_bo_create/export/import/AddFB chain each time, once through
+ * the pool. */
+static void run_churn(struct gbm_device *gbm, int kms_fd,
+		uint32_t width, uint32_t height, int iterations, uint64_t cap)
+{
+	const uint32_t sizes[][2] = {
+		{ width, height },
+		{ width / 2, height / 2 },
+		{ width, height / 8 },
+		{ 256, 256 },
+	};
+	const uint32_t flags = GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT;
+	const int per_iteration = 4;
+	struct pool_bo *held[4];
+	uint64_t *ns = malloc(iterations * per_iteration * sizeof(*ns));
+	struct bo_pool *pool = bo_pool_create(gbm, kms_fd, cap);
+	struct bo_pool_stats stats;
+
+	assert(ns && pool);
+
+	for (int pooled = 0; pooled < 2; pooled++) {
+		int count = 0;
+
+		srand(1);
+		for (int i = 0; i < iterations; i++) {
+			for (int b = 0; b < per_iteration; b++) {
+				const uint32_t *size = sizes[rand() % ARRAY_SIZE(sizes)];
+				uint64_t start = now_ns();
+
+				if (pooled)
+					held[b] = bo_pool_get(pool, size[0], size[1],
+							GBM_FORMAT_XRGB8888,
+							DRM_FORMAT_MOD_INVALID, flags);
+				else
+					held[b] = pool_bo_create(gbm, kms_fd, size[0], size[1],
+							GBM_FORMAT_XRGB8888,
+							DRM_FORMAT_MOD_INVALID, flags);
+				if (held[b])
+					ns[count++] = now_ns() - start;
+			}
+
+			for (int b = 0; b < per_iteration; b++) {
+				if (!held[b])
+					continue;
+				if (pooled)
+					bo_pool_put(pool, held[b]);
+				else
+					pool_bo_destroy(kms_fd, held[b]);
+			}
+		}
+
+		print_latencies(pooled ? "pool" : "no pool", ns, count);
+	}
+
+	bo_pool_get_stats(pool, &stats);
+	printf("pool: %llu hits, %llu misses, %llu trimmed, %d buffers (%.1f MiB) cached under a %.1f MiB cap\n",
+			(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+			(unsigned long long)stats.trimmed, stats.cached,
+			stats.cached_bytes / 1048576.0, cap / 1048576.0);
+
+	bo_pool_destroy(pool);
+	free(ns);
+}
+
+/* Render to a few buffers in turn, as a compositor or a client with a
+ * swapchain does, first building the target from scratch every frame,
+ * then through the cache, timing how long getting ready to draw takes. */
+static void run_target_switch(EGLDisplay dpy, struct gbm_device *gbm,
+		int kms_fd, struct fbo_cache *cache, int frames,
+		uint32_t width, uint32_t height)
+{
+	const int count = 3;
+	struct pool_bo *buffers[3];
+	uint64_t *ns = malloc(frames * sizeof(*ns));
+	struct fbo_cache_stats stats;
+
+	assert(ns);
+
+	for (int b = 0; b < count; b++) {
+		buffers[b] = pool_bo_create(gbm, kms_fd, width, height,
+				GBM_FORMAT_XRGB8888, DRM_FORMAT_MOD_INVALID,
+				GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+		assert(buffers[b] != NULL);
+	}
+
+	for (int cached = 0; cached < 2; cached++) {
+		for (int f = 0; f < frames; f++) {
+			struct pool_bo *pbo = buffers[f % count];
+			struct cached_fbo target;
+			uint64_t start = now_ns();
+
+			if (cached) {
+				assert(fbo_cache_bind(cache, pbo->dma_buf_fd, pbo->bo));
+			} else {
+				assert(fbo_create(dpy, pbo->bo, &target) == 0);
+				glViewport(0, 0, target.width, target.height);
+			}
+			ns[f] = now_ns() - start;
+
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glFinish();
+
+			if (!cached)
+				fbo_destroy(dpy, &target);
+		}
+
+		print_latencies(cached ? "cached" : "uncached", ns, frames);
+	}
+
+	fbo_cache_get_stats(cache, &stats);
+	printf("fbo cache: %llu hits, %llu misses, %llu evicted, %d targets\n",
+			(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+			(unsigned long long)stats.evicted, stats.count);
+
+	for (int b = 0; b < count; b++) {
+		fbo_cache_forget(cache, buffers[b]->dma_buf_fd);
+		pool_bo_destroy(kms_fd, buffers[b]);
+	}
+	free(ns);
+}
+
+enum stage {
+	STAGE_ALLOC,
+	STAGE_EXPORT,
+	STAGE_IMPORT,
+	STAGE_ADDFB,
+	STAGE_FIRST_DRAW,
+	STAGE_DRAW,
+	STAGE_READBACK,
+	STAGE_COUNT
+};
+
+static const char *stage_names[] = {
+	"alloc", "export", "import", "addfb", "1st draw", "draw", "readback"
+};
+
+static const struct {
+	uint32_t format;
+	uint32_t bpp, depth;
+} bench_formats[] = {
+	{ GBM_FORMAT_XRGB8888, 32, 24 },
+	{ GBM_FORMAT_ARGB8888, 32, 32 },
+	{ GBM_FORMAT_RGB565, 16, 16 },
+};
+
+static const uint32_t bench_sizes[][2] = {
+	{ 1280, 720 },
+	{ 1920, 1080 },
+	{ 3840, 2160 },
+};
+
+static void draw_scene(void)
+{
+	GLfloat vertex[] = {
+		-1, -1, 0,
+		-1, 1, 0,
+		1, 1, 0,
+	};
+	GLint position = glGetAttribLocation(program, "positionIn");
+
+	glEnableVertexAttribArray(position);
+	glVertexAttribPointer(position, 3, GL_FLOAT, 0, 0, vertex);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+static void draw_frame(void)
+{
+	draw_scene();
+	glFinish();
+}
+
+/* One buffer through the whole path, timing each step in ms. gpu_alloc
+ * picks who allocates, as for the single buffer test: the render node
+ * with GBM then KMS imports it, or KMS as a dumb buffer then GBM imports
+ * it. */
+static int bench_strategy(int gpu_alloc, EGLDisplay dpy,
+		struct gbm_device *gbm, int kms_fd,
+		uint32_t width, uint32_t height, int f, int draws,
+		double ms[STAGE_COUNT])
+{
+	const uint32_t format = bench_formats[f].format;
+	struct gbm_bo *bo = NULL;
+	uint32_t handle = 0, fb_id = 0, stride = 0;
+	int dma_buf_fd = -1;
+	struct drm_mode_create_dumb create_request = {
+		.width  = width,
+		.height = height,
+		.bpp    = bench_formats[f].bpp
+	};
+	struct cached_fbo target;
+	int ret = -1;
+	uint64_t t;
+
+	t = now_ns();
+	if (gpu_alloc) {
+		bo = gbm_bo_create(gbm, width, height, format,
+				GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+		if (!bo)
+			return -1;
+		stride = gbm_bo_get_stride(bo);
+	} else {
+		if (ioctl(kms_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_request))
+			return -1;
+		handle = create_request.handle;
+		stride = create_request.pitch;
+	}
+	ms[STAGE_ALLOC] = (now_ns() - t) / 1e6;
+
+	t = now_ns();
+	if (gpu_alloc) {
+		dma_buf_fd = gbm_bo_get_fd(bo);
+	} else {
+		struct drm_prime_handle prime_request = {
+			.handle = handle,
+			.flags  = DRM_CLOEXEC | DRM_RDWR,
+			.fd     = -1
+		};
+
+		ioctl(kms_fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime_request);
+		dma_buf_fd = prime_request.fd;
+	}
+	ms[STAGE_EXPORT] = (now_ns() - t) / 1e6;
+	if (dma_buf_fd < 0)
+		goto out;
+
+	t = now_ns();
+	if (gpu_alloc) {
+		if (drmPrimeFDToHandle(kms_fd, dma_buf_fd, &handle))
+			goto out;
+	} else {
+		struct gbm_import_fd_data data = {
+			.fd = dma_buf_fd,
+			.width = width,
+			.height = height,
+			.stride = stride,
+			.format = format,
+		};
+
+		bo = gbm_bo_import(gbm, GBM_BO_IMPORT_FD, &data,
+				GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+		if (!bo)
+			goto out;
+	}
+	ms[STAGE_IMPORT] = (now_ns() - t) / 1e6;
+
+	t = now_ns();
+	{
+		uint32_t handles[4] = { handle }, pitches[4] = { stride };
+		uint32_t offsets[4] = { 0 };
+
+		if (drmModeAddFB2(kms_fd, width, height, format, handles, pitches,
+				offsets, &fb_id, 0)) {
+			fb_id = 0;
+			goto out;
+		}
+	}
+	ms[STAGE_ADDFB] = (now_ns() - t) / 1e6;
+
+	/* The first frame pays for the import into the driver and whatever
+	 * it does lazily on first use. */
+	t = now_ns();
+	if (fbo_create(dpy, bo, &target))
+		goto out;
+	glViewport(0, 0, width, height);
+	draw_frame();
+	ms[STAGE_FIRST_DRAW] = (now_ns() - t) / 1e6;
+
+	t = now_ns();
+	for (int i = 0; i < draws; i++)
+		draw_frame();
+	ms[STAGE_DRAW] = (now_ns() - t) / 1e6 / draws;
+
+	/* Through GBM, which detiles for us when it has to */
+	t = now_ns();
+	{
+		void *map_data = NULL;
+		uint32_t map_stride;
+		uint8_t *map = gbm_bo_map(bo, 0, 0, width, height,
+				GBM_BO_TRANSFER_READ, &map_stride, &map_data);
+		uint8_t *copy = malloc(stride * height);
+		const uint32_t row = width * bench_formats[f].bpp / 8;
+
+		if (map && copy)
+			for (uint32_t y = 0; y < height; y++)
+				memcpy(copy + y * row, map + y * map_stride, row);
+		if (map)
+			gbm_bo_unmap(bo, map_data);
+		free(copy);
+		ms[STAGE_READBACK] = map ? (now_ns() - t) / 1e6 : -1;
+	}
+
+	fbo_destroy(dpy, &target);
+	ret = 0;
+
+out:
+	if (fb_id)
+		drmModeRmFB(kms_fd, fb_id);
+	if (bo)
+		gbm_bo_destroy(bo);
+	if (dma_buf_fd >= 0)
+		close(dma_buf_fd);
+	if (handle) {
+		if (gpu_alloc) {
+			struct drm_gem_close close_request = { .handle = handle };
+
+			ioctl(kms_fd, DRM_IOCTL_GEM_CLOSE, &close_request);
+		} else {
+			struct drm_mode_destroy_dumb destroy_request = {
+				.handle = handle
+			};
+
+			ioctl(kms_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_request);
+		}
+	}
+	return ret;
+}
+
+/* Both strategies, for every size and format, averaged over a few runs */
+static void run_alloc_bench(EGLDisplay dpy, struct gbm_device *gbm,
+		int kms_fd, int runs)
+{
+	printf("%-9s %-10s %-4s", "strategy", "size", "fmt");
+	for (int s = 0; s < STAGE_COUNT; s++)
+		printf(" %9s", stage_names[s]);
+	printf("   (ms)\n");
+
+	for (unsigned int size = 0; size < ARRAY_SIZE(bench_sizes); size++) {
+		for (unsigned int f = 0; f < ARRAY_SIZE(bench_formats); f++) {
+			for (int gpu_alloc = 0; gpu_alloc < 2; gpu_alloc++) {
+				const uint32_t format = bench_formats[f].format;
+				double total[STAGE_COUNT] = { 0 };
+				char dims[16];
+				int done = 0;
+
+				for (int r = 0; r < runs; r++) {
+					double ms[STAGE_COUNT];
+
+					if (bench_strategy(gpu_alloc, dpy, gbm, kms_fd,
+							bench_sizes[size][0], bench_sizes[size][1],
+							f, 10, ms))
+						break;
+					for (int s = 0; s < STAGE_COUNT; s++)
+						total[s] += ms[s];
+					done++;
+				}
+
+				snprintf(dims, sizeof(dims), "%ux%u",
+						bench_sizes[size][0], bench_sizes[size][1]);
+				printf("%-9s %-10s %c%c%c%c",
+						gpu_alloc ? "gpu_alloc" : "dumb", dims,
+						format & 0xff, (format >> 8) & 0xff,
+						(format >> 16) & 0xff, (format >> 24) & 0xff);
+				if (!done) {
+					printf(" %9s\n", "failed");
+					continue;
+				}
+				for (int s = 0; s < STAGE_COUNT; s++)
+					printf(" %9.3f", total[s] / done);
+				printf("\n");
+			}
+		}
+	}
+}
+
+static GLuint create_program(const char *vert, const char *frag)
+{
+	GLuint prog;
+	GLint linked;
+
+	assert((prog = glCreateProgram()) != 0);
+	glAttachShader(prog, LoadShader(vert, GL_VERTEX_SHADER));
+	glAttachShader(prog, LoadShader(frag, GL_FRAGMENT_SHADER));
+	glBindAttribLocation(prog, 0, "positionIn");
+	glBindAttribLocation(prog, 1, "texcoordIn");
+	glLinkProgram(prog);
+	glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		fprintf(stderr, "Error linking %s and %s\n", vert, frag);
+		exit(1);
+	}
+
+	return prog;
+}
+
+/* What a video decoder hands out: planes of one dma-buf */
+static const struct yuv_format {
+	const char *name;
+	uint32_t fourcc;
+	int planes;
+	/* bytes per sample, P010 keeps 10 bits in the top of 16 */
+	int bytes;
+} yuv_formats[] = {
+	{ "NV12", DRM_FORMAT_NV12, 2, 1 },
+	{ "YUV420", DRM_FORMAT_YUV420, 3, 1 },
+	{ "P010", DRM_FORMAT_P010, 2, 2 },
+};
+
+struct yuv_buffer {
+	const struct yuv_format *format;
+	uint32_t width, height;
+	uint32_t handle;
+	int fd;
+	uint8_t *map;
+	uint64_t size;
+	uint32_t offsets[3], pitches[3];
+};
+
+/* A linear dumb buffer tall enough for all the planes, one after the
+ * other, as most decoders lay them out. */
+static int create_yuv_buffer(int kms_fd, const struct yuv_format *format,
+		uint32_t width, uint32_t height, struct yuv_buffer *buf)
+{
+	struct drm_mode_create_dumb create_request = {
+		.width  = width,
+		.height = height * 3 / 2,
+		.bpp    = 8 * format->bytes
+	};
+	struct drm_mode_map_dumb map_request = { 0 };
+	struct drm_prime_handle prime_request = {
+		.flags = DRM_CLOEXEC | DRM_RDWR,
+		.fd    = -1
+	};
+	uint32_t pitch;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->format = format;
+	buf->width = width;
+	buf->height = height;
+	buf->fd = -1;
+
+	if (ioctl(kms_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_request))
+		return -1;
+	buf->handle = create_request.handle;
+	buf->size = create_request.size;
+	pitch = create_request.pitch;
+
+	map_request.handle = buf->handle;
+	if (ioctl(kms_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_request))
+		return -1;
+	buf->map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			kms_fd, map_request.offset);
+	if (buf->map == MAP_FAILED) {
+		buf->map = NULL;
+		return -1;
+	}
+
+	prime_request.handle = buf->handle;
+	if (ioctl(kms_fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime_request))
+		return -1;
+	buf->fd = prime_request.fd;
+
+	buf->pitches[0] = pitch;
+	if (format->planes == 2) {
+		/* interleaved chroma, half as many rows */
+		buf->offsets[1] = pitch * height;
+		buf->pitches[1] = pitch;
+	} else {
+		/* U then V, half as wide and half as many rows */
+		buf->offsets[1] = pitch * height;
+		buf->pitches[1] = pitch / 2;
+		buf->offsets[2] = buf->offsets[1] + pitch / 2 * height / 2;
+		buf->pitches[2] = pitch / 2;
+	}
+
+	return 0;
+}
+
+static void destroy_yuv_buffer(int kms_fd, struct yuv_buffer *buf)
+{
+	struct drm_mode_destroy_dumb destroy_request = {
+		.handle = buf->handle
+	};
+
+	if (buf->map)
+		munmap(buf->map, buf->size);
+	if (buf->fd >= 0)
+		close(buf->fd);
+	if (buf->handle)
+		ioctl(kms_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_request);
+}
+
+/* Sample i of a row in plane p, as 8 bits */
+static uint8_t *yuv_sample(struct yuv_buffer *buf, int p, uint32_t y,
+		uint32_t i)
+{
+	return buf->map + buf->offsets[p] + y * buf->pitches[p] +
+		i * buf->format->bytes;
+}
+
+static void put_sample(struct yuv_buffer *buf, int p, uint32_t y,
+		uint32_t i, uint8_t value)
+{
+	uint8_t *sample = yuv_sample(buf, p, y, i);
+
+	if (buf->format->bytes == 2)
+		*(uint16_t *)sample = value << 8;
+	else
+		*sample = value;
+}
+
+static uint8_t get_sample(struct yuv_buffer *buf, int p, uint32_t y,
+		uint32_t i)
+{
+	uint8_t *sample = yuv_sample(buf, p, y, i);
+
+	if (buf->format->bytes == 2)
+		return *(uint16_t *)sample >> 8;
+	return *sample;
+}
+
+/* Luma ramp left to right, chroma sweeping across both axes */
+static void fill_yuv_buffer(struct yuv_buffer *buf)
+{
+	for (uint32_t y = 0; y < buf->height; y++)
+		for (uint32_t x = 0; x < buf->width; x++)
+			put_sample(buf, 0, y, x, 16 + x * 219 / buf->width);
+
+	for (uint32_t y = 0; y < buf->height / 2; y++) {
+		for (uint32_t x = 0; x < buf->width / 2; x++) {
+			uint8_t u = 16 + y * 2 * 224 / buf->height;
+			uint8_t v = 240 - x * 2 * 224 / buf->width;
+
+			if (buf->format->planes == 2) {
+				put_sample(buf, 1, y, 2 * x, u);
+				put_sample(buf, 1, y, 2 * x + 1, v);
+			} else {
+				put_sample(buf, 1, y, x, u);
+				put_sample(buf, 2, y, x, v);
+			}
+		}
+	}
+}
+
+static uint8_t clamp_u8(int value)
+{
+	return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/* What we'd do without the import: BT.709, limited range, to RGBA */
+static void convert_yuv_buffer(struct yuv_buffer *buf, uint8_t *rgba)
+{
+	for (uint32_t y = 0; y < buf->height; y++) {
+		for (uint32_t x = 0; x < buf->width; x++) {
+			int c = get_sample(buf, 0, y, x) - 16;
+			int d, e;
+
+			if (buf->format->planes == 2) {
+				d = get_sample(buf, 1, y / 2, x / 2 * 2) - 128;
+				e = get_sample(buf, 1, y / 2, x / 2 * 2 + 1) - 128;
+			} else {
+				d = get_sample(buf, 1, y / 2, x / 2) - 128;
+				e = get_sample(buf, 2, y / 2, x / 2) - 128;
+			}
+
+			rgba[0] = clamp_u8((298 * c + 459 * e + 128) >> 8);
+			rgba[1] = clamp_u8((298 * c - 55 * d - 136 * e + 128) >> 8);
+			rgba[2] = clamp_u8((298 * c + 541 * d + 128) >> 8);
+			rgba[3] = 255;
+			rgba += 4;
+		}
+	}
+}
+
+static EGLImageKHR import_yuv_buffer(EGLDisplay dpy, struct yuv_buffer *buf)
+{
+	static const EGLint plane_attribs[3][3] = {
+		{ EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE0_PITCH_EXT },
+		{ EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE1_PITCH_EXT },
+		{ EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE2_PITCH_EXT },
+	};
+	EGLint attribs[64];
+	int a = 0;
+
+	attribs[a++] = EGL_WIDTH;
+	attribs[a++] = buf->width;
+	attribs[a++] = EGL_HEIGHT;
+	attribs[a++] = buf->height;
+	attribs[a++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[a++] = buf->format->fourcc;
+	for (int p = 0; p < buf->format->planes; p++) {
+		attribs[a++] = plane_attribs[p][0];
+		attribs[a++] = buf->fd;
+		attribs[a++] = plane_attribs[p][1];
+		attribs[a++] = buf->offsets[p];
+		attribs[a++] = plane_attribs[p][2];
+		attribs[a++] = buf->pitches[p];
+	}
+	attribs[a++] = EGL_YUV_COLOR_SPACE_HINT_EXT;
+	attribs[a++] = EGL_ITU_REC709_EXT;
+	attribs[a++] = EGL_SAMPLE_RANGE_HINT_EXT;
+	attribs[a++] = EGL_YUV_NARROW_RANGE_EXT;
+	attribs[a++] = EGL_NONE;
+
+	return eglCreateImageKHR(dpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+			NULL, attribs);
+}
+
+static void draw_textured(GLuint prog, GLenum target, GLuint tex)
+{
+	static const GLfloat position[] = { -1, -1, 1, -1, -1, 1, 1, 1 };
+	static const GLfloat texcoord[] = { 0, 1, 1, 1, 0, 0, 1, 0 };
+
+	glUseProgram(prog);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, tex);
+	glUniform1i(glGetUniformLocation(prog, "tex"), 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, 0, 0, position);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, 0, 0, texcoord);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glFinish();
+}
+
+/* Draw every format into a scanout buffer, straight from the decoder's
+ * dma-buf, then the way we'd have to without the import: convert on the
+ * CPU and upload. */
+static void run_yuv_bench(EGLDisplay dpy, struct gbm_device *gbm, int kms_fd,
+		int frames, uint32_t width, uint32_t height)
+{
+	const int zero_copy = epoxy_has_egl_extension(dpy,
+			"EGL_EXT_image_dma_buf_import");
+	GLuint external_prog = 0, rgb_prog;
+	struct cached_fbo target;
+	struct pool_bo *scanout;
+	uint8_t *rgba = malloc(width * height * 4);
+	GLuint tex;
+
+	assert(rgba);
+
+	if (zero_copy)
+		external_prog = create_program("yuv.vert", "yuv-external.frag");
+	else
+		printf("no EGL_EXT_image_dma_buf_import, CPU conversion only\n");
+	rgb_prog = create_program("yuv.vert", "yuv-rgb.frag");
+
+	scanout = pool_bo_create(gbm, kms_fd, width, height, GBM_FORMAT_XRGB8888,
+			DRM_FORMAT_MOD_INVALID,
+			GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+	assert(scanout);
+	assert(fbo_create(dpy, scanout->bo, &target) == 0);
+	glViewport(0, 0, width, height);
+
+	printf("%ux%u, %d frames, ms per frame\n", width, height, frames);
+	printf("%-7s %10s %10s %10s %10s %10s\n", "format", "import",
+			"zero-copy", "convert", "upload", "cpu path");
+
+	for (unsigned int f = 0; f < ARRAY_SIZE(yuv_formats); f++) {
+		struct yuv_buffer buf;
+		double import_ms = -1, zero_copy_ms = -1;
+		uint64_t convert_ns = 0, upload_ns = 0, t;
+
+		if (create_yuv_buffer(kms_fd, &yuv_formats[f], width, height, &buf)) {
+			printf("%-7s could not allocate: %s\n", yuv_formats[f].name,
+					strerror(errno));
+			destroy_yuv_buffer(kms_fd, &buf);
+			continue;
+		}
+		fill_yuv_buffer(&buf);
+
+		if (zero_copy) {
+			t = now_ns();
+			EGLImageKHR image = import_yuv_buffer(dpy, &buf);
+
+			if (image != EGL_NO_IMAGE_KHR) {
+				glGenTextures(1, &tex);
+				glBindTexture(GL_TEXTURE_EXTERNAL_OES, tex);
+				glTexParameteri(GL_TEXTURE_EXTERNAL_OES,
+						GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_EXTERNAL_OES,
+						GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+				glEGLImageTargetTexture2DOES(GL_TEXTURE_EXTERNAL_OES,
+						image);
+				draw_textured(external_prog, GL_TEXTURE_EXTERNAL_OES, tex);
+				import_ms = (now_ns() - t) / 1e6;
+
+				t = now_ns();
+				for (int i = 0; i < frames; i++)
+					draw_textured(external_prog,
+							GL_TEXTURE_EXTERNAL_OES, tex);
+				zero_copy_ms = (now_ns() - t) / 1e6 / frames;
+
+				glDeleteTextures(1, &tex);
+				eglDestroyImageKHR(dpy, image);
+			} else {
+				printf("%-7s import failed: 0x%x\n", yuv_formats[f].name,
+						eglGetError());
+			}
+		}
+
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
+				GL_UNSIGNED_BYTE, NULL);
+
+		/* A new decoded frame each time, so convert and upload each time */
+		uint64_t const start = now_ns();
+		for (int i = 0; i < frames; i++) {
+			t = now_ns();
+			convert_yuv_buffer(&buf, rgba);
+			convert_ns += now_ns() - t;
+
+			t = now_ns();
+			glBindTexture(GL_TEXTURE_2D, tex);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA,
+					GL_UNSIGNED_BYTE, rgba);
+			upload_ns += now_ns() - t;
+
+			draw_textured(rgb_prog, GL_TEXTURE_2D, tex);
+		}
+		double const cpu_ms = (now_ns() - start) / 1e6 / frames;
+
+		glDeleteTextures(1, &tex);
+
+		printf("%-7s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+				yuv_formats[f].name, import_ms, zero_copy_ms,
+				convert_ns / 1e6 / frames, upload_ns / 1e6 / frames, cpu_ms);
+
+		destroy_yuv_buffer(kms_fd, &buf);
+	}
+
+	fbo_destroy(dpy, &target);
+	pool_bo_destroy(kms_fd, scanout);
+	if (external_prog)
+		glDeleteProgram(external_prog);
+	glDeleteProgram(rgb_prog);
+	free(rgba);
+}
+
+/* Let the display's own allocator pick among the modifiers both sides
+ * handle, since it's the pickier of the two */
+static struct gbm_bo *create_display_bo(int kms_fd, uint32_t width,
+		uint32_t height, const uint64_t *modifiers, int count)
+{
+	static struct gbm_device *display_gbm;
+
+	if (!display_gbm)
+		display_gbm = gbm_create_device(kms_fd);
+	if (!display_gbm)
+		return NULL;
+
+	return gbm_bo_create_with_modifiers(display_gbm, width, height,
+			GBM_FORMAT_XRGB8888, modifiers, count);
+}
+
+#define MAX_RING 4
+
+struct ring_flip {
+	int pending;
+	uint64_t time_ns;
+};
+
+static void ring_flip_handler(int fd, unsigned int frame,
+		unsigned int sec, unsigned int usec, void *data)
+{
+	struct ring_flip *flip = data;
+
+	(void)fd;
+	(void)frame;
+	flip->pending = 0;
+	flip->time_ns = sec * 1000000000ull + usec * 1000ull;
+}
+
+/* Blocks until the pending flip is done */
+static int ring_wait_flip(int kms_fd, struct ring_flip *flip)
+{
+	drmEventContext evctx = {
+		.version = 2,
+		.page_flip_handler = ring_flip_handler,
+	};
+	struct pollfd pfd = {
+		.fd = kms_fd,
+		.events = POLLIN,
+	};
+
+	while (flip->pending) {
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			return -1;
+		}
+		drmHandleEvent(kms_fd, &evctx);
+	}
+
+	return 0;
+}
+
+/* The render node draws to buffers the display node scans out, count of
+ * them in turn, frame k always in buffer k % count. A buffer is free again
+ * once the frame after it is on screen; a fence tells when the GPU is done
+ * with a frame, which is when it can be flipped to. The GPU keeps
+ * rendering ahead while a flip waits for the vblank, as far as the free
+ * buffers allow. */
+static void run_ring(EGLDisplay dpy, struct gbm_device *gbm, int kms_fd,
+		uint32_t crtc_id, struct fbo_cache *cache, int count, int frames,
+		uint32_t width, uint32_t height, uint64_t modifier,
+		uint32_t restore_fb_id)
+{
+	const int fences = epoxy_has_egl_extension(dpy, "EGL_KHR_fence_sync");
+	struct pool_bo *buffers[MAX_RING];
+	EGLSyncKHR sync[MAX_RING];
+	uint64_t *started = malloc(frames * sizeof(*started));
+	uint64_t *render_ns = malloc(frames * sizeof(*render_ns));
+	uint64_t *screen_ns = malloc(frames * sizeof(*screen_ns));
+	struct ring_flip flip = { 0 };
+	/* frames submitted to the GPU, done rendering, flipped to, and on
+	 * screen, each one past the last one */
+	int submitted = 0, completed = 0, flipped = 0, displayed = 0;
+	uint64_t start;
+
+	assert(started && render_ns && screen_ns);
+
+	if (count < 2)
+		count = 2;
+	if (count > MAX_RING)
+		count = MAX_RING;
+	if (!fences)
+		printf("no EGL_KHR_fence_sync, waiting with glFinish\n");
+
+	for (int b = 0; b < count; b++) {
+		buffers[b] = pool_bo_create(gbm, kms_fd, width, height,
+				GBM_FORMAT_XRGB8888, modifier,
+				GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+		assert(buffers[b] != NULL);
+		/* Build every target up front, not on the first frame */
+		assert(fbo_cache_get(cache, buffers[b]->dma_buf_fd, buffers[b]->bo));
+		sync[b] = EGL_NO_SYNC_KHR;
+	}
+
+	start = now_ns();
+	while (displayed < frames) {
+		int const free_until = displayed + count - 1 > count ?
+			displayed + count - 1 : count;
+
+		if (submitted < frames && submitted < free_until) {
+			int const b = submitted % count;
+			float const shade = (submitted % 60) / 60.0f;
+
+			assert(fbo_cache_bind(cache, buffers[b]->dma_buf_fd,
+						buffers[b]->bo));
+			started[submitted] = now_ns();
+			glClearColor(shade, 0, 1 - shade, 1);
+			draw_scene();
+			if (fences)
+				sync[b] = eglCreateSyncKHR(dpy, EGL_SYNC_FENCE_KHR, NULL);
+			if (sync[b] != EGL_NO_SYNC_KHR)
+				glFlush();
+			else
+				glFinish();
+			submitted++;
+			continue;
+		}
+
+		if (!flip.pending && flipped < completed) {
+			/* Nothing queued when it fails, nothing to wait for */
+			if (drmModePageFlip(kms_fd, crtc_id,
+						buffers[flipped % count]->fb_id,
+						DRM_MODE_PAGE_FLIP_EVENT, &flip)) {
+				fprintf(stderr, "page flip failed: %s\n", strerror(errno));
+				break;
+			}
+			flip.pending = 1;
+			flipped++;
+			continue;
+		}
+
+		if (completed < submitted) {
+			int const b = completed % count;
+
+			if (sync[b] != EGL_NO_SYNC_KHR) {
+				eglClientWaitSyncKHR(dpy, sync[b],
+						EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+						EGL_FOREVER_KHR);
+				eglDestroySyncKHR(dpy, sync[b]);
+				sync[b] = EGL_NO_SYNC_KHR;
+			}
+			render_ns[completed] = now_ns() - started[completed];
+			completed++;
+			continue;
+		}
+
+		if (ring_wait_flip(kms_fd, &flip))
+			break;
+		/* Vblank timestamps are on the monotonic clock too */
+		screen_ns[displayed] = flip.time_ns - started[displayed];
+		displayed++;
+	}
+
+	if (flip.pending)
+		ring_wait_flip(kms_fd, &flip);
+
+	double const seconds = (now_ns() - start) / 1e9;
+
+	printf("%d buffers, %d frames in %.2f s : %.1f fps\n",
+			count, displayed, seconds, displayed / seconds);
+	print_latencies("render", render_ns, completed);
+	print_latencies("screen", screen_ns, displayed);
+
+	/* Put the buffer the test started with back, before taking these
+	 * away from the display */
+	if (drmModePageFlip(kms_fd, crtc_id, restore_fb_id,
+				DRM_MODE_PAGE_FLIP_EVENT, &flip) == 0) {
+		flip.pending = 1;
+		ring_wait_flip(kms_fd, &flip);
+	}
+
+	for (int b = 0; b < count; b++) {
+		if (sync[b] != EGL_NO_SYNC_KHR)
+			eglDestroySyncKHR(dpy, sync[b]);
+		fbo_cache_forget(cache, buffers[b]->dma_buf_fd);
+		pool_bo_destroy(kms_fd, buffers[b]);
+	}
+	free(started);
+	free(render_ns);
+	free(screen_ns);
+}
+
 int main(int argc, char **argv)
 {
 	putenv("EGL_LOG_LEVEL=warning"); putenv("MESA_DEBUG=1"); putenv("LIBGL_DEBUG=verbose");
 
 	int gpu_alloc = 0;
-
-	if (argc > 1) {
-		if (strcmp(argv[1], "gpu_alloc") == 0) {
+	int linear = 0;
+	int churn = 0;
+	int switch_frames = 0;
+	int bench = 0;
+	int ring = 0;
+	int ring_frames = 600;
+	int yuv = 0;
+	uint32_t yuv_width = 3840, yuv_height = 2160;
+	uint64_t pool_cap = 64 << 20;
+
+	for (int arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "gpu_alloc") == 0) {
 			gpu_alloc = 1;
 		}
+		else if (strcmp(argv[arg], "linear") == 0) {
+			/* skip the negotiation, as before */
+			linear = 1;
+		}
+		else if (strncmp(argv[arg], "churn=", 6) == 0) {
+			churn = atoi(argv[arg] + 6);
+		}
+		else if (strcmp(argv[arg], "churn") == 0) {
+			churn = 1000;
+		}
+		else if (strncmp(argv[arg], "bench=", 6) == 0) {
+			bench = atoi(argv[arg] + 6);
+		}
+		else if (strcmp(argv[arg], "bench") == 0) {
+			bench = 5;
+		}
+		else if (strncmp(argv[arg], "yuv=", 4) == 0) {
+			yuv = atoi(argv[arg] + 4);
+		}
+		else if (strcmp(argv[arg], "yuv") == 0) {
+			yuv = 60;
+		}
+		else if (strncmp(argv[arg], "yuv_size=", 9) == 0) {
+			sscanf(argv[arg] + 9, "%ux%u", &yuv_width, &yuv_height);
+		}
+		else if (strncmp(argv[arg], "ring=", 5) == 0) {
+			ring = atoi(argv[arg] + 5);
+		}
+		else if (strcmp(argv[arg], "ring") == 0) {
+			ring = 3;
+		}
+		else if (strncmp(argv[arg], "ring_frames=", 12) == 0) {
+			ring_frames = atoi(argv[arg] + 12);
+		}
+		else if (strncmp(argv[arg], "switch=", 7) == 0) {
+			switch_frames = atoi(argv[arg] + 7);
+		}
+		else if (strncmp(argv[arg], "cap=", 4) == 0) {
+			/* in MiB */
+			pool_cap = strtoull(argv[arg] + 4, NULL, 0) << 20;
+		}
 	}
 
 	int ret;
@@ -283,16 +1268,55 @@ int main(int argc, char **argv)
 	gpu_gbm = gbm_create_device(gpu_fd);
 	assert(gpu_gbm != NULL);
 
+	if (churn) {
+		run_churn(gpu_gbm, hdmi_fd, chosen_resolution->hdisplay,
+				chosen_resolution->vdisplay, churn, pool_cap);
+		return 0;
+	}
+
+	/* The render node is asked which layouts it renders to, so that's
+	 * needed before allocating */
+	EGLDisplay dpy;
+	dpy = eglGetDisplay(gpu_gbm);
+
+	EGLint major, minor;
+	const char *ver;//, *extensions;
+	assert(eglInitialize(dpy, &major, &minor) == EGL_TRUE);
+	ver = eglQueryString(dpy, EGL_VERSION);
+//	extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+
+	printf("ver = %s\n", ver);
+
+	uint64_t *modifiers = NULL;
+	int modifier_count = 0;
+
+	if (!linear) {
+		modifier_count = negotiate_modifiers(dpy, hdmi_fd,
+				encoder->crtc_id, GBM_FORMAT_XRGB8888, &modifiers);
+		printf("%d modifiers in common between %s and %s\n",
+				modifier_count, gpu_dev, hdmi_dev);
+		for (int m = 0; m < modifier_count; m++)
+			printf("  0x%016" PRIx64 "\n", modifiers[m]);
+	}
+
 	int dma_buf_fd;
 	int stride;
 	uint32_t prime_handle;
-	struct gbm_bo *gpu_bo;
+	struct gbm_bo *gpu_bo = NULL;
+	/* The display side's bo, when it allocates with modifiers */
+	struct gbm_bo *display_bo = NULL;
 
 	if (gpu_alloc) {
-		gpu_bo = gbm_bo_create(gpu_gbm,
-				chosen_resolution->hdisplay, chosen_resolution->vdisplay,
-				GBM_FORMAT_XRGB8888,
-				GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+		if (modifier_count > 0)
+			gpu_bo = gbm_bo_create_with_modifiers(gpu_gbm,
+					chosen_resolution->hdisplay,
+					chosen_resolution->vdisplay,
+					GBM_FORMAT_XRGB8888, modifiers, modifier_count);
+		if (gpu_bo == NULL)
+			gpu_bo = gbm_bo_create(gpu_gbm,
+					chosen_resolution->hdisplay, chosen_resolution->vdisplay,
+					GBM_FORMAT_XRGB8888,
+					GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
 
 		if (gpu_bo == NULL) {
 			printf("Could not create bo : %s (%d)\n",
@@ -313,6 +1337,38 @@ int main(int argc, char **argv)
 
 		printf("[display] Imported buffer FD : %d\n", dma_buf_fd);
 	}
+	else if (modifier_count > 0 &&
+		 (display_bo = create_display_bo(hdmi_fd,
+				chosen_resolution->hdisplay, chosen_resolution->vdisplay,
+				modifiers, modifier_count)) != NULL) {
+		dma_buf_fd = gbm_bo_get_fd(display_bo);
+		prime_handle = gbm_bo_get_handle(display_bo).u32;
+		stride = gbm_bo_get_stride(display_bo);
+		printf("[display] Exported buffer FD : %d\n", dma_buf_fd);
+
+		/* Tell the GPU the layout rather than let it guess */
+		struct gbm_import_fd_modifier_data data = {
+			.width    = chosen_resolution->hdisplay,
+			.height   = chosen_resolution->vdisplay,
+			.format   = GBM_FORMAT_XRGB8888,
+			.num_fds  = gbm_bo_get_plane_count(display_bo),
+			.modifier = gbm_bo_get_modifier(display_bo)
+		};
+		for (unsigned int p = 0; p < data.num_fds; p++) {
+			data.fds[p] = dma_buf_fd;
+			data.strides[p] = gbm_bo_get_stride_for_plane(display_bo, p);
+			data.offsets[p] = gbm_bo_get_offset(display_bo, p);
+		}
+		gpu_bo = gbm_bo_import(gpu_gbm, GBM_BO_IMPORT_FD_MODIFIER, &data,
+				GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+		if (gpu_bo == NULL) {
+			printf("Could not import buffer : %s (%d) - FD : %d\n",
+					strerror(errno), errno, dma_buf_fd);
+			return -1;
+		}
+
+		printf("[gpu] Imported buffer FD : %d\n", dma_buf_fd);
+	}
 	else {
 		struct drm_mode_create_dumb create_request = {
 			.width  = chosen_resolution->hdisplay,
@@ -363,29 +1419,42 @@ int main(int argc, char **argv)
 	}
 
 	uint32_t fb_id;
-	ret = drmModeAddFB(
-			hdmi_fd, chosen_resolution->hdisplay, chosen_resolution->vdisplay,
-			24, 32, stride, prime_handle, &fb_id
-			);
+	struct gbm_bo *scanout_bo = display_bo ? display_bo : gpu_bo;
+	uint64_t const modifier = modifier_count > 0 ?
+		gbm_bo_get_modifier(scanout_bo) : DRM_FORMAT_MOD_INVALID;
+
+	if (modifier != DRM_FORMAT_MOD_INVALID) {
+		uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+		uint64_t fb_modifiers[4] = { 0 };
+
+		for (int p = 0; p < gbm_bo_get_plane_count(scanout_bo) && p < 4; p++) {
+			handles[p] = prime_handle;
+			pitches[p] = gbm_bo_get_stride_for_plane(scanout_bo, p);
+			offsets[p] = gbm_bo_get_offset(scanout_bo, p);
+			fb_modifiers[p] = modifier;
+		}
+		printf("scanning out with modifier 0x%016" PRIx64 "\n", modifier);
+		ret = drmModeAddFB2WithModifiers(hdmi_fd,
+				chosen_resolution->hdisplay, chosen_resolution->vdisplay,
+				GBM_FORMAT_XRGB8888, handles, pitches, offsets,
+				fb_modifiers, &fb_id, DRM_MODE_FB_MODIFIERS);
+	}
+	else {
+		printf("scanning out linear\n");
+		ret = drmModeAddFB(
+				hdmi_fd, chosen_resolution->hdisplay, chosen_resolution->vdisplay,
+				24, 32, stride, prime_handle, &fb_id
+				);
+	}
 	if (ret) {
-		printf("Could not add a framebuffer using drmModeAddFB : %s\n", strerror(ret));
+		printf("Could not add a framebuffer : %s\n", strerror(errno));
 		return -1;
 	}
+	free(modifiers);
 
 	drmModeSetCrtc(hdmi_fd, encoder->crtc_id, fb_id, 0, 0,
 			&connector->connector_id, 1, chosen_resolution);
 
-	EGLDisplay dpy;
-	dpy = eglGetDisplay(gpu_gbm);
-
-	EGLint major, minor;
-	const char *ver;//, *extensions;
-	assert(eglInitialize(dpy, &major, &minor) == EGL_TRUE);
-	ver = eglQueryString(dpy, EGL_VERSION);
-//	extensions = eglQueryString(dpy, EGL_EXTENSIONS);
-
-	printf("ver = %s\n", ver);
-
 	EGLContext ctx;
 	static const EGLint ctx_attribs[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
@@ -414,26 +1483,33 @@ int main(int argc, char **argv)
 
 	eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx);
 
-	GLuint fb, color_rb, depth_rb;
-	glGenFramebuffers(1, &fb);
-	glBindFramebuffer(GL_FRAMEBUFFER_EXT, fb);
+	if (yuv) {
+		run_yuv_bench(dpy, gpu_gbm, hdmi_fd, yuv, yuv_width, yuv_height);
+		return 0;
+	}
+
+	if (bench) {
+		InitGLES();
+		run_alloc_bench(dpy, gpu_gbm, hdmi_fd, bench);
+		return 0;
+	}
 
-	EGLImageKHR image;
-	image = eglCreateImageKHR(dpy, NULL, EGL_NATIVE_PIXMAP_KHR, gpu_bo, NULL);
+	struct fbo_cache *targets = fbo_cache_create(dpy, 8);
+	assert(targets != NULL);
 
-	/* Set up render buffer... */
-	glGenRenderbuffers(1, &color_rb);
-	glBindRenderbuffer(GL_RENDERBUFFER_EXT, color_rb);
-	glEGLImageTargetRenderbufferStorageOES(GL_RENDERBUFFER, image);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, color_rb);
+	if (switch_frames)
+		run_target_switch(dpy, gpu_gbm, hdmi_fd, targets, switch_frames,
+				chosen_resolution->hdisplay, chosen_resolution->vdisplay);
 
-	/* and depth buffer */
-	glGenRenderbuffers(1, &depth_rb);
-	glBindRenderbuffer(GL_RENDERBUFFER_EXT, depth_rb);
-	glRenderbufferStorage(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT16, chosen_resolution->hdisplay, chosen_resolution->vdisplay);
-	glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, depth_rb);
+	if (ring) {
+		InitGLES();
+		run_ring(dpy, gpu_gbm, hdmi_fd, encoder->crtc_id, targets, ring,
+				ring_frames, chosen_resolution->hdisplay,
+				chosen_resolution->vdisplay, modifier, fb_id);
+		return 0;
+	}
 
-	if ((glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT)) != GL_FRAMEBUFFER_COMPLETE) {
+	if (!fbo_cache_bind(targets, dma_buf_fd, gpu_bo)) {
 		fprintf(stderr, "something bad happened\n");
 		exit(-1);
 	}
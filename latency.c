@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+
+uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+	uint64_t const x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+void print_latencies(const char *what, uint64_t *ns, int count)
+{
+	uint64_t total = 0;
+
+	if (!count)
+		return;
+
+	qsort(ns, count, sizeof(*ns), compare_u64);
+	for (int i = 0; i < count; i++)
+		total += ns[i];
+
+	printf("%-10s %6d times: avg %8.1f us, p50 %8.1f us, p99 %8.1f us, max %8.1f us\n",
+			what, count, total / 1e3 / count, ns[count / 2] / 1e3,
+			ns[count * 99 / 100] / 1e3, ns[count - 1] / 1e3);
+}
+
+uint64_t process_memory(const char *key)
+{
+	FILE *f = fopen("/proc/self/status", "r");
+	size_t const key_len = strlen(key);
+	char line[256];
+	uint64_t kb = 0;
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (strncmp(line, key, key_len) == 0 && line[key_len] == ':')
+			kb = strtoull(line + key_len + 1, NULL, 10);
+	fclose(f);
+
+	return kb;
+}
@@ -0,0 +1,22 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+/* Timing what the test programs do, and summing it up */
+
+/* CLOCK_MONOTONIC, the same in every process */
+uint64_t now_ns(void);
+
+/* For qsort() */
+int compare_u64(const void *a, const void *b);
+
+/* One line with the average, median, 99th percentile and worst of count
+ * samples. Sorts ns. */
+void print_latencies(const char *what, uint64_t *ns, int count);
+
+/* In kB, from /proc/self/status : key is VmRSS, VmSize... 0 when the
+ * kernel doesn't tell. */
+uint64_t process_memory(const char *key);
+
+#endif
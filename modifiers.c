@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "modifiers.h"
+
+static uint32_t get_plane_prop(int fd, uint32_t plane_id, const char *name,
+                               uint64_t *value)
+{
+	drmModeObjectProperties *props =
+		drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+	uint32_t id = 0;
+
+	if (!props)
+		return 0;
+
+	for (uint32_t p = 0; p < props->count_props && !id; p++) {
+		drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[p]);
+
+		if (!prop)
+			continue;
+		if (strcmp(prop->name, name) == 0) {
+			id = prop->prop_id;
+			*value = props->prop_values[p];
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return id;
+}
+
+static uint32_t find_primary_plane(int fd, uint32_t crtc_id)
+{
+	drmModeRes *res;
+	drmModePlaneRes *planes;
+	uint32_t plane_id = 0;
+	int crtc_index = -1;
+
+	/* Primary planes are hidden from clients that don't ask for them */
+	if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1))
+		return 0;
+
+	res = drmModeGetResources(fd);
+	if (!res)
+		return 0;
+	for (int c = 0; c < res->count_crtcs; c++)
+		if (res->crtcs[c] == crtc_id)
+			crtc_index = c;
+	drmModeFreeResources(res);
+
+	planes = drmModeGetPlaneResources(fd);
+	if (crtc_index < 0 || !planes)
+		return 0;
+
+	for (uint32_t p = 0; p < planes->count_planes && !plane_id; p++) {
+		drmModePlane *plane = drmModeGetPlane(fd, planes->planes[p]);
+		uint64_t type = 0;
+
+		if (!plane)
+			continue;
+		if (plane->possible_crtcs & (1 << crtc_index) &&
+		    get_plane_prop(fd, plane->plane_id, "type", &type) &&
+		    type == DRM_PLANE_TYPE_PRIMARY)
+			plane_id = plane->plane_id;
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(planes);
+
+	return plane_id;
+}
+
+int kms_plane_modifiers(int kms_fd, uint32_t crtc_id, uint32_t format,
+                        uint64_t **modifiers)
+{
+	drmModePropertyBlobRes *blob;
+	struct drm_format_modifier_blob *header;
+	struct drm_format_modifier *mods;
+	uint32_t *formats;
+	uint64_t blob_id;
+	uint32_t plane_id;
+	int format_index = -1;
+	int count = 0;
+
+	*modifiers = NULL;
+
+	plane_id = find_primary_plane(kms_fd, crtc_id);
+	if (!plane_id)
+		return -1;
+
+	/* Drivers without modifier support don't have the property */
+	if (!get_plane_prop(kms_fd, plane_id, "IN_FORMATS", &blob_id) ||
+	    !blob_id)
+		return 0;
+
+	blob = drmModeGetPropertyBlob(kms_fd, blob_id);
+	if (!blob)
+		return -1;
+
+	header = blob->data;
+	formats = (uint32_t *)((char *) header + header->formats_offset);
+	mods = (struct drm_format_modifier *)
+		((char *) header + header->modifiers_offset);
+
+	for (uint32_t f = 0; f < header->count_formats; f++)
+		if (formats[f] == format)
+			format_index = f;
+
+	*modifiers = calloc(header->count_modifiers + 1, sizeof(**modifiers));
+	if (!*modifiers) {
+		drmModeFreePropertyBlob(blob);
+		return -1;
+	}
+
+	/* Each modifier says which of 64 formats, from offset on, it goes
+	 * with */
+	for (uint32_t m = 0; m < header->count_modifiers && format_index >= 0;
+	     m++) {
+		int const bit = format_index - (int) mods[m].offset;
+
+		if (bit >= 0 && bit < 64 && mods[m].formats & (1ull << bit))
+			(*modifiers)[count++] = mods[m].modifier;
+	}
+	drmModeFreePropertyBlob(blob);
+
+	return count;
+}
+
+int egl_render_modifiers(EGLDisplay dpy, uint32_t format,
+                         uint64_t **modifiers)
+{
+	EGLuint64KHR *mods;
+	EGLBoolean *external_only;
+	EGLint total = 0;
+	int count = 0;
+
+	*modifiers = NULL;
+
+	if (!epoxy_has_egl_extension(dpy, "EGL_EXT_image_dma_buf_import_modifiers"))
+		return 0;
+
+	if (!eglQueryDmaBufModifiersEXT(dpy, format, 0, NULL, NULL, &total))
+		return -1;
+	if (!total)
+		return 0;
+
+	mods = calloc(total, sizeof(*mods));
+	external_only = calloc(total, sizeof(*external_only));
+	*modifiers = calloc(total, sizeof(**modifiers));
+	if (!mods || !external_only || !*modifiers ||
+	    !eglQueryDmaBufModifiersEXT(dpy, format, total, mods, external_only,
+	                                &total)) {
+		free(mods);
+		free(external_only);
+		free(*modifiers);
+		*modifiers = NULL;
+		return -1;
+	}
+
+	for (int m = 0; m < total; m++)
+		if (!external_only[m])
+			(*modifiers)[count++] = mods[m];
+
+	free(mods);
+	free(external_only);
+
+	return count;
+}
+
+int negotiate_modifiers(EGLDisplay dpy, int kms_fd, uint32_t crtc_id,
+                        uint32_t format, uint64_t **modifiers)
+{
+	uint64_t *display, *render;
+	int display_count, render_count;
+	int count = 0, tiled = 0;
+
+	*modifiers = NULL;
+
+	display_count = kms_plane_modifiers(kms_fd, crtc_id, format, &display);
+	render_count = egl_render_modifiers(dpy, format, &render);
+
+	if (display_count > 0 && render_count > 0) {
+		for (int d = 0; d < display_count; d++) {
+			for (int r = 0; r < render_count; r++) {
+				if (display[d] != render[r])
+					continue;
+				display[count++] = display[d];
+				if (display[d] != DRM_FORMAT_MOD_LINEAR)
+					tiled++;
+				break;
+			}
+		}
+
+		/* Anything but linear, if we can */
+		if (tiled) {
+			int kept = 0;
+
+			for (int m = 0; m < count; m++)
+				if (display[m] != DRM_FORMAT_MOD_LINEAR)
+					display[kept++] = display[m];
+			count = kept;
+		}
+	}
+
+	free(render);
+	if (count > 0) {
+		*modifiers = display;
+	} else {
+		free(display);
+		count = display_count < 0 || render_count < 0 ? -1 : 0;
+	}
+
+	return count;
+}
@@ -0,0 +1,31 @@
+#ifndef MODIFIERS_H
+#define MODIFIERS_H
+
+#include <stdint.h>
+
+#include <epoxy/egl.h>
+
+/* The render node and the display node each know which layouts they can
+ * deal with for a format. Linear is the one they nearly always share, and
+ * the slowest one to render to on tilers, so only settle for it when there
+ * is nothing better in common.
+ *
+ * The lists are malloc()ed, and the counts returned, 0 when the device
+ * doesn't say and -1 on error. */
+
+/* What the primary plane of crtc_id scans out format with, from the
+ * plane's IN_FORMATS blob */
+int kms_plane_modifiers(int kms_fd, uint32_t crtc_id, uint32_t format,
+                        uint64_t **modifiers);
+/* What the GPU behind dpy renders to format with, leaving out the
+ * modifiers it can only sample from */
+int egl_render_modifiers(EGLDisplay dpy, uint32_t format,
+                         uint64_t **modifiers);
+
+/* Both lists intersected, in the display's order, linear left out
+ * whenever anything else is in common. 0 means there's nothing to
+ * negotiate with : fall back to an implicit or linear layout. */
+int negotiate_modifiers(EGLDisplay dpy, int kms_fd, uint32_t crtc_id,
+                        uint32_t format, uint64_t **modifiers);
+
+#endif
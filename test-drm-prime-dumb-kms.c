@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <libdrm/drm.h>
 
+#include <inttypes.h>
 #include <stdint.h>
 
 #include <sys/mman.h>
@@ -17,12 +18,18 @@
 #include <sys/ioctl.h>
 #include <errno.h>
 
+#include <math.h>
+#include <poll.h>
+
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
-// rand
+// malloc, atoi
 #include <stdlib.h>
 
+#include "dumb-draw.h"
+#include "dumb-raster.h"
+
 #define LOG(msg, ...) \
 	fprintf(\
 		stderr, "\n[%s (%s:%d)]\n"msg,\
@@ -98,10 +105,430 @@ static void dump_mode(drmModeModeInfo *mode)
 	printf("\n");
 }
 
+/* The primary plane of our CRTC and what we need to point it at a
+ * framebuffer with damage clips, when the driver supports them. */
+struct damage_plane {
+	uint32_t plane_id;
+	uint32_t fb_id_prop;
+	uint32_t damage_clips_prop;
+};
+
+static uint32_t get_plane_prop(
+	int fd, uint32_t plane_id, char const * __restrict name,
+	uint64_t * __restrict value)
+{
+	drmModeObjectProperties * __restrict props =
+		drmModeObjectGetProperties(fd, plane_id, DRM_MODE_OBJECT_PLANE);
+	uint32_t id = 0;
+
+	if (!props)
+		return 0;
+
+	for (uint32_t p = 0; p < props->count_props && !id; p++) {
+		drmModePropertyRes * __restrict prop =
+			drmModeGetProperty(fd, props->props[p]);
+
+		if (!prop)
+			continue;
+		if (strcmp(prop->name, name) == 0) {
+			id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[p];
+		}
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+
+	return id;
+}
+
+/* FB_DAMAGE_CLIPS only exists through atomic. Returns 0 when we can use it
+ * on the primary plane of crtc_id. */
+static int find_damage_plane(
+	int fd, drmModeRes * __restrict res, uint32_t crtc_id,
+	struct damage_plane * __restrict dp)
+{
+	drmModePlaneRes * __restrict planes;
+	int crtc_index = -1;
+
+	if (drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1))
+		return -1;
+
+	for (int_fast32_t c = 0; c < res->count_crtcs; c++)
+		if (res->crtcs[c] == crtc_id)
+			crtc_index = c;
+
+	planes = drmModeGetPlaneResources(fd);
+	if (crtc_index < 0 || !planes)
+		return -1;
+
+	dp->plane_id = 0;
+	for (uint32_t p = 0; p < planes->count_planes && !dp->plane_id; p++) {
+		drmModePlane * __restrict plane =
+			drmModeGetPlane(fd, planes->planes[p]);
+		uint64_t type = 0;
+
+		if (!plane)
+			continue;
+		if (plane->possible_crtcs & (1 << crtc_index) &&
+		    get_plane_prop(fd, plane->plane_id, "type", &type) &&
+		    type == DRM_PLANE_TYPE_PRIMARY)
+			dp->plane_id = plane->plane_id;
+		drmModeFreePlane(plane);
+	}
+	drmModeFreePlaneResources(planes);
+
+	if (!dp->plane_id)
+		return -1;
+
+	dp->fb_id_prop = get_plane_prop(fd, dp->plane_id, "FB_ID", NULL);
+	dp->damage_clips_prop =
+		get_plane_prop(fd, dp->plane_id, "FB_DAMAGE_CLIPS", NULL);
+
+	return dp->fb_id_prop && dp->damage_clips_prop ? 0 : -1;
+}
+
+/* Tell the kernel which parts of the framebuffer changed, either through
+ * the plane damage clips with atomic, or the older DirtyFB ioctl.
+ * Drivers that scan out straight from memory don't implement DirtyFB
+ * and say so with ENOSYS, which is just fine. */
+static int flush_damage(
+	int fd, uint32_t fb_id, struct damage_plane const * __restrict dp,
+	struct dumb_damage const * __restrict damage)
+{
+	int ret;
+
+	if (!damage->count)
+		return 0;
+
+	if (dp) {
+		struct drm_mode_rect clips[DUMB_MAX_DAMAGE];
+		drmModeAtomicReq * __restrict req;
+		uint32_t blob_id;
+
+		for (int i = 0; i < damage->count; i++) {
+			struct dumb_rect const * __restrict r = &damage->rects[i];
+
+			clips[i] = (struct drm_mode_rect) {
+				r->x, r->y, r->x + r->w, r->y + r->h
+			};
+		}
+
+		ret = drmModeCreatePropertyBlob(
+			fd, clips, damage->count * sizeof(*clips), &blob_id);
+		if (ret)
+			return ret;
+
+		req = drmModeAtomicAlloc();
+		drmModeAtomicAddProperty(req, dp->plane_id, dp->fb_id_prop, fb_id);
+		drmModeAtomicAddProperty(
+			req, dp->plane_id, dp->damage_clips_prop, blob_id);
+		ret = drmModeAtomicCommit(fd, req, 0, NULL);
+		drmModeAtomicFree(req);
+		drmModeDestroyPropertyBlob(fd, blob_id);
+	} else {
+		drmModeClip clips[DUMB_MAX_DAMAGE];
+
+		for (int i = 0; i < damage->count; i++) {
+			struct dumb_rect const * __restrict r = &damage->rects[i];
+
+			clips[i] = (drmModeClip) {
+				r->x, r->y, r->x + r->w, r->y + r->h
+			};
+		}
+
+		ret = drmModeDirtyFB(fd, fb_id, clips, damage->count);
+		if (ret == -ENOSYS)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+/* When drawing went to the shadow buffer, copy what changed to the
+ * scanout mapping first. */
+static int present_damage(
+	int fd, uint32_t fb_id, struct damage_plane const * __restrict dp,
+	struct dumb_surface * __restrict scanout,
+	struct dumb_surface const * __restrict shadow,
+	struct dumb_damage const * __restrict damage)
+{
+	if (shadow)
+		dumb_shadow_flush(scanout, shadow, damage);
+
+	return flush_damage(fd, fb_id, dp, damage);
+}
+
+/* Scroll the screen up a few rows and draw a translucent bar over it, like
+ * a terminal or a compositor would. Both read the pixels back. */
+static void readback_pass(struct dumb_surface * __restrict s, int i)
+{
+	struct dumb_rect const whole = { 0, 0, s->width, s->height };
+	struct dumb_rect const bottom = { 0, s->height - 8, s->width, 8 };
+	struct dumb_rect const bar = {
+		s->width / 4, (i * 13) % s->height, s->width / 2, 64
+	};
+
+	dumb_scroll(s, &whole, 8);
+	dumb_fill(s, &bottom, (i & 1) ? 0x404040 : 0x808080);
+	dumb_blend(s, &bar, 0xffffff, 96);
+}
+
+/* One buffer of the swapchain : a dumb buffer, its framebuffer and its
+ * PRIME mapping. */
+struct swap_buffer {
+	uint32_t handle;
+	uint32_t fb_id;
+	int prime_fd;
+	struct dumb_surface surface;
+};
+
+static int create_swap_buffer(
+	int fd, uint32_t width, uint32_t height,
+	struct swap_buffer * __restrict buffer)
+{
+	struct drm_mode_create_dumb create_request = {
+		.width  = width,
+		.height = height,
+		.bpp    = 32
+	};
+	struct drm_prime_handle prime_request = {
+		.flags = DRM_CLOEXEC | DRM_RDWR,
+		.fd    = -1
+	};
+
+	memset(buffer, 0, sizeof(*buffer));
+	buffer->prime_fd = -1;
+
+	if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_request)) {
+		LOG("Could not allocate a %ux%u dumb buffer : %m\n", width, height);
+		return -1;
+	}
+	buffer->handle = create_request.handle;
+
+	if (drmModeAddFB(fd, width, height, 24, 32, create_request.pitch,
+	                 buffer->handle, &buffer->fb_id)) {
+		LOG("Could not add a framebuffer : %m\n");
+		return -1;
+	}
+
+	prime_request.handle = buffer->handle;
+	if (ioctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &prime_request)) {
+		LOG("Could not export buffer : %m\n");
+		return -1;
+	}
+	buffer->prime_fd = prime_request.fd;
+
+	buffer->surface = (struct dumb_surface) {
+		.map    = mmap(0, create_request.size, PROT_READ | PROT_WRITE,
+		               MAP_SHARED, buffer->prime_fd, 0),
+		.width  = width,
+		.height = height,
+		.pitch  = create_request.pitch,
+		.size   = create_request.size
+	};
+	if (buffer->surface.map == MAP_FAILED) {
+		LOG("Could not map buffer exported through PRIME : %m\n");
+		buffer->surface.map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void destroy_swap_buffer(int fd, struct swap_buffer * __restrict buffer)
+{
+	struct drm_mode_destroy_dumb destroy_request = {
+		.handle = buffer->handle
+	};
+
+	if (buffer->surface.map)
+		munmap(buffer->surface.map, buffer->surface.size);
+	if (buffer->prime_fd >= 0)
+		close(buffer->prime_fd);
+	if (buffer->fb_id)
+		drmModeRmFB(fd, buffer->fb_id);
+	if (buffer->handle)
+		ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_request);
+}
+
+struct swap_flip {
+	int pending;
+	unsigned int sequence;
+};
+
+static void swap_flip_handler(
+	int fd, unsigned int sequence, unsigned int sec, unsigned int usec,
+	void *data)
+{
+	struct swap_flip * __restrict flip = data;
+
+	(void) fd; (void) sec; (void) usec;
+	flip->pending = 0;
+	flip->sequence = sequence;
+}
+
+static int wait_for_swap_flip(int fd, struct swap_flip * __restrict flip)
+{
+	drmEventContext event_context = {
+		.version = 2,
+		.page_flip_handler = swap_flip_handler
+	};
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	while (flip->pending) {
+		if (poll(&pfd, 1, 1000) <= 0) {
+			LOG("Timed out waiting for the page flip\n");
+			return -1;
+		}
+		drmHandleEvent(fd, &event_context);
+	}
+
+	return 0;
+}
+
+/* Everything gets redrawn : what's in a back buffer is a few frames old */
+static void draw_swap_frame(
+	struct dumb_surface * __restrict s, uint64_t frame, int raster)
+{
+	struct dumb_rect const whole = { 0, 0, s->width, s->height };
+
+	if (raster) {
+		struct dumb_vertex v[3];
+
+		for (int i = 0; i < 3; i++) {
+			double const angle = frame * M_PI / 120 + i * 2 * M_PI / 3;
+
+			v[i] = (struct dumb_vertex) {
+				0.9 * cos(angle), 0.9 * sin(angle),
+				i == 0, i == 1, i == 2
+			};
+		}
+		dumb_fill(s, &whole, 0);
+		dumb_triangle(s, v);
+	} else {
+		int32_t const size = s->height / 4;
+		uint32_t const travel = s->width - size;
+		uint32_t const x = frame * 8 % (2 * travel);
+		struct dumb_rect const box = {
+			x < travel ? x : 2 * travel - x, (s->height - size) / 2,
+			size, size
+		};
+
+		dumb_gradient(s, &whole, 0x000040, 0x4040c0, 1);
+		dumb_fill(s, &box, 0xffffff);
+	}
+}
+
+/* Draw into a back buffer, flip to it on the next vblank, and go on with
+ * the next one. With two buffers we wait for the flip before drawing over
+ * what was on screen; a third one lets drawing overlap the pending flip. */
+static void run_swapchain(
+	int fd, uint32_t crtc_id, drmModeModeInfo const * __restrict mode,
+	struct swap_buffer * __restrict buffers, int count,
+	int seconds, int raster)
+{
+	uint64_t const budget_ns =
+		1000000000ull / (mode->vrefresh ? mode->vrefresh : 60);
+	uint64_t const end = dumb_now_ns() + seconds * 1000000000ull;
+	uint64_t frames = 0, draw_total = 0, draw_max = 0, over_budget = 0;
+	uint64_t missed = 0;
+	unsigned int last_sequence = 0;
+	struct swap_flip flip = { 0 };
+	int front = 0, next = 1, pending = -1;
+
+	while (dumb_now_ns() < end) {
+		if (pending >= 0 && next == front) {
+			if (wait_for_swap_flip(fd, &flip))
+				break;
+			front = pending;
+			pending = -1;
+		}
+
+		uint64_t const start = dumb_now_ns();
+		draw_swap_frame(&buffers[next].surface, frames, raster);
+		uint64_t const draw = dumb_now_ns() - start;
+
+		draw_total += draw;
+		draw_max = draw > draw_max ? draw : draw_max;
+		over_budget += draw > budget_ns;
+
+		if (pending >= 0) {
+			if (wait_for_swap_flip(fd, &flip))
+				break;
+			front = pending;
+			pending = -1;
+		}
+
+		if (last_sequence && flip.sequence - last_sequence > 1)
+			missed += flip.sequence - last_sequence - 1;
+		last_sequence = flip.sequence;
+
+		flip.pending = 1;
+		if (drmModePageFlip(fd, crtc_id, buffers[next].fb_id,
+		                    DRM_MODE_PAGE_FLIP_EVENT, &flip)) {
+			LOG("Could not queue the page flip : %m\n");
+			flip.pending = 0;
+			break;
+		}
+		pending = next;
+		next = (next + 1) % count;
+		frames++;
+	}
+
+	if (pending >= 0 && wait_for_swap_flip(fd, &flip) == 0)
+		front = pending;
+
+	/* Put back the buffer the CRTC was set up with, the others are going
+	 * away. */
+	if (front != 0) {
+		flip.pending = 1;
+		if (drmModePageFlip(fd, crtc_id, buffers[0].fb_id,
+		                    DRM_MODE_PAGE_FLIP_EVENT, &flip) == 0)
+			wait_for_swap_flip(fd, &flip);
+	}
+
+	if (!frames)
+		return;
+
+	printf("%d buffers, %llu frames : drawing takes %.3f ms on average, "
+	       "%.3f ms at worst, out of %.3f ms per vblank\n",
+	       count, (unsigned long long) frames,
+	       draw_total / 1e6 / frames, draw_max / 1e6, budget_ns / 1e6);
+	printf("%llu frames over budget, %llu vblanks missed\n",
+	       (unsigned long long) over_budget, (unsigned long long) missed);
+}
 
 // Works on Rockchip systems but fail with ENOSYS on AMDGPU
-int main()
+int main(int argc, char **argv)
 {
+	/* threads=0 draws with one thread per CPU */
+	int threads = 0, iterations = 100, seconds = 5;
+	/* dirtyfb forces the legacy damage path even with atomic around */
+	int dirtyfb = 0;
+	/* shadow draws the scene into cached memory, then copies the damage */
+	int shadow = 0;
+	/* raster shows the egl-color triangle, drawn by the CPU */
+	int raster = 0;
+	/* swapchain=2 or 3 flips between buffers instead of drawing on screen */
+	int swapchain = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "threads=", 8) == 0)
+			threads = atoi(argv[i] + 8);
+		else if (strncmp(argv[i], "iterations=", 11) == 0)
+			iterations = atoi(argv[i] + 11);
+		else if (strncmp(argv[i], "seconds=", 8) == 0)
+			seconds = atoi(argv[i] + 8);
+		else if (strcmp(argv[i], "dirtyfb") == 0)
+			dirtyfb = 1;
+		else if (strcmp(argv[i], "shadow") == 0)
+			shadow = 1;
+		else if (strcmp(argv[i], "raster") == 0)
+			raster = 1;
+		else if (strncmp(argv[i], "swapchain=", 10) == 0)
+			swapchain = atoi(argv[i] + 10);
+	}
 
 	/* DRM is based on the fact that you can connect multiple screens,
 	 * on multiple different connectors which have, of course, multiple
@@ -318,21 +745,28 @@ int main()
 	LOG("Buffer mapped !\n");
 
 	/* The fun begins ! At last !
-	 * We'll do something simple :
-	 * We'll lit a row of pixel, on the screen, starting from the top,
-	 * down to the bottom of screen, using either Red, Blue or Green
-	 * randomly, each time we press Enter.
-	 * If we press 'q' and then Enter, the process will stop.
-	 * The process will also stop once we've reached the bottom of the
-	 * screen.
+	 * We'll first measure how fast the CPU can write into the mapping,
+	 * since that's all a software rendered display has to offer, then
+	 * leave a small scene on screen for a few seconds.
 	 */
-	uint32_t const bytes_per_pixel = 4;
-	uint_fast64_t
-	  pixel = 0,
-	  size = create_request.size;
+	struct dumb_surface surface = {
+		.map    = primed_framebuffer,
+		.width  = create_request.width,
+		.height = create_request.height,
+		.pitch  = create_request.pitch,
+		.size   = create_request.size
+	};
+	struct dumb_rect const whole_screen = {
+		0, 0, create_request.width, create_request.height
+	};
+	uint64_t const screen_bytes =
+		(uint64_t) create_request.width * create_request.height * 4;
 
-	/* Cleanup the framebuffer */
-	memset(primed_framebuffer, 0, size);
+	dumb_draw_init(threads);
+	printf("Drawing with %s using %d threads into %ux%u (pitch %u, %llu bytes)\n",
+	       dumb_draw_isa(), dumb_draw_threads(),
+	       create_request.width, create_request.height, create_request.pitch,
+	       (unsigned long long) create_request.size);
 
 	/* The colors table */
 	uint32_t const red   = (0xff<<16);
@@ -341,49 +775,286 @@ int main()
 	uint32_t const white   = (0xffffff);
 	uint32_t const colors[] = {red, green, blue, white};
 
-	/* Pitch is the stride in bytes.
-	 * However, for our purpose we'd like to know the stride in pixels.
-	 * So we'll divide the pitch (in bytes) by the number of bytes
-	 * composing a pixel to get that information.
-	 */
-	uint32_t const stride_pixel = create_request.pitch / bytes_per_pixel;
-	uint32_t const width_pixel  = create_request.width;
-
-	/* The width is padded so that each row starts with a specific
-	 * alignment. That means that we have useless pixels that we could
-	 * avoid dealing with in the first place.
-	 * Now, it might be faster to just lit these useless pixels and get
-	 * done with it. */
-	uint32_t const diff_between_width_and_stride =
-		stride_pixel - width_pixel;
-	uint_fast64_t const size_in_pixels =
-		create_request.height * stride_pixel;
-
-	/* While we didn't get a 'q' + Enter or reached the bottom of the
-	 * screen... */
-	while (pixel < size_in_pixels) {
-		/* Choose a random color. 3 being the size of the colors table. */
-		uint32_t current_color = colors[rand()%ARRAY_SIZE(colors)];
-
-		/* Color every pixel of the row.
-		 * Now, the framebuffer is linear. Meaning that the first pixel of
-		 * the first row should be at index 0, but the first pixel of the
-		 * second row should be at index (stride+0) and the first pixel of
-		 * the n-th row should be at (n*stride+0).
-		 *
-		 * Instead of computing the value, we'll just increment the "pixel"
-		 * index and accumulate the padding once done with the current row,
-		 * in order to be ready to start for the next row.
-		 */
-		for (uint_fast32_t p = 0; p < width_pixel; p++) {
-			if (p > 700) current_color ^= 0xffffff;
-			((uint32_t *) primed_framebuffer)[pixel++] = current_color;
+	/* Something to blit from : a checkerboard, in plain cached memory,
+	 * just like a client's software rendered window would be. */
+	uint32_t * __restrict image =
+		malloc(screen_bytes);
+
+	if (!image) {
+		LOG("Could not allocate a %ux%u image to blit\n",
+		    create_request.width, create_request.height);
+		goto could_not_allocate_image;
+	}
+
+	for (uint_fast32_t y = 0; y < create_request.height; y++)
+		for (uint_fast32_t x = 0; x < create_request.width; x++)
+			image[y * create_request.width + x] =
+				((x / 64) ^ (y / 64)) & 1 ? white : 0x202020;
+
+	uint64_t start = dumb_now_ns();
+	for (int i = 0; i < iterations; i++)
+		dumb_fill(&surface, &whole_screen, colors[i % ARRAY_SIZE(colors)]);
+	dumb_report("fill", &surface, screen_bytes * iterations,
+	            dumb_now_ns() - start);
+
+	start = dumb_now_ns();
+	for (int i = 0; i < iterations; i++)
+		dumb_gradient(&surface, &whole_screen, red, blue, i & 1);
+	dumb_report("gradient", &surface, screen_bytes * iterations,
+	            dumb_now_ns() - start);
+
+	start = dumb_now_ns();
+	for (int i = 0; i < iterations; i++)
+		dumb_blit(&surface, &whole_screen, image, create_request.width * 4);
+	dumb_report("blit", &surface, screen_bytes * iterations,
+	            dumb_now_ns() - start);
+
+	/* Small rectangles are what a desktop mostly redraws */
+	struct dumb_rect small = { 0, 0, 64, 64 };
+	start = dumb_now_ns();
+	for (int i = 0; i < iterations * 64; i++) {
+		small.x = (i * 97) % create_request.width;
+		small.y = (i * 61) % create_request.height;
+		dumb_fill(&surface, &small, colors[i % ARRAY_SIZE(colors)]);
+	}
+	dumb_report("fill 64x64", &surface, 64 * 64 * 4ull * iterations * 64,
+	            dumb_now_ns() - start);
+
+	/* Drawing that reads back, straight into the mapping then through a
+	 * shadow buffer that gets copied out once per frame. */
+	struct dumb_surface shadow_surface;
+	struct dumb_damage damage;
+	int const have_shadow = dumb_shadow_init(
+		&shadow_surface, create_request.width, create_request.height) == 0;
+
+	start = dumb_now_ns();
+	for (int i = 0; i < iterations; i++)
+		readback_pass(&surface, i);
+	dumb_report("readback", &surface, screen_bytes * iterations,
+	            dumb_now_ns() - start);
+
+	if (have_shadow) {
+		shadow_surface.damage = &damage;
+		start = dumb_now_ns();
+		for (int i = 0; i < iterations; i++) {
+			dumb_damage_reset(&damage);
+			readback_pass(&shadow_surface, i);
+			dumb_shadow_flush(&surface, &shadow_surface, &damage);
 		}
-		pixel += diff_between_width_and_stride;
-		LOG("pixel : %lu, size : %lu, width_pixel : %u\n", pixel, size_in_pixels, width_pixel);
-		usleep(100000);
+		dumb_report("  shadowed", &surface, screen_bytes * iterations,
+		            dumb_now_ns() - start);
+		shadow_surface.damage = NULL;
+	} else {
+		LOG("Could not allocate a shadow buffer\n");
+		shadow = 0;
 	}
 
+	/* What egl-color draws, as egl-color.vert sees it */
+	struct dumb_vertex const triangle[3] = {
+		{ -1, -1, 1, 0, 0 },
+		{ -1,  1, 0, 1, 0 },
+		{  1,  1, 0, 0, 1 },
+	};
+
+	if (raster) {
+		start = dumb_now_ns();
+		for (int i = 0; i < iterations; i++) {
+			dumb_fill(&surface, &whole_screen, 0);
+			dumb_triangle(&surface, triangle);
+		}
+		dumb_report("triangle", &surface, screen_bytes * iterations,
+		            dumb_now_ns() - start);
+
+		/* Check the fast path against the one pixel at a time one */
+		if (have_shadow) {
+			uint32_t * __restrict reference = calloc(
+				create_request.width * create_request.height, 4);
+			struct dumb_surface reference_surface = {
+				.map    = (uint8_t *) reference,
+				.width  = create_request.width,
+				.height = create_request.height,
+				.pitch  = create_request.width * 4,
+				.size   = screen_bytes
+			};
+			uint_fast64_t mismatches = 0;
+
+			if (reference) {
+				dumb_fill(&shadow_surface, &whole_screen, 0);
+				dumb_triangle(&shadow_surface, triangle);
+				dumb_triangle_reference(&reference_surface, triangle);
+
+				for (uint_fast32_t y = 0; y < create_request.height; y++) {
+					uint32_t const * __restrict row = (uint32_t *)
+						(shadow_surface.map + y * shadow_surface.pitch);
+
+					for (uint_fast32_t x = 0; x < create_request.width; x++) {
+						uint32_t const a = row[x];
+						uint32_t const b =
+							reference[y * create_request.width + x];
+
+						/* Coverage must match, colors within rounding */
+						for (int c = 0; c < 24; c += 8) {
+							int const d = (int) ((a >> c) & 0xff) -
+							              (int) ((b >> c) & 0xff);
+
+							if (d > 1 || d < -1 || !a != !b) {
+								mismatches++;
+								break;
+							}
+						}
+					}
+				}
+				printf("Triangle : %" PRIuFAST64 " pixels differ from the reference\n",
+				       mismatches);
+				free(reference);
+			}
+		}
+	}
+
+	/* Either flip between buffers we draw whole frames into... */
+	if (swapchain > 1) {
+		struct swap_buffer buffers[3] = {
+			{
+				.handle   = create_request.handle,
+				.fb_id    = frame_buffer_id,
+				.prime_fd = -1,
+				.surface  = surface
+			}
+		};
+		int count = 1;
+
+		if (swapchain > 3)
+			swapchain = 3;
+		for (; count < swapchain; count++)
+			if (create_swap_buffer(kms_fd, create_request.width,
+			                       create_request.height, &buffers[count]))
+				break;
+
+		if (count == swapchain)
+			run_swapchain(kms_fd, current_crtc_id, chosen_resolution,
+			              buffers, count, seconds, raster);
+		else
+			destroy_swap_buffer(kms_fd, &buffers[count]);
+
+		for (int i = 1; i < count; i++)
+			destroy_swap_buffer(kms_fd, &buffers[i]);
+
+		goto swapchain_done;
+	}
+
+	/* ...or draw on screen, telling the kernel what we draw */
+	struct damage_plane damage_plane;
+	struct damage_plane * __restrict dp = NULL;
+	struct dumb_surface * __restrict canvas =
+		shadow ? &shadow_surface : &surface;
+	struct dumb_surface const * __restrict shadowed =
+		shadow ? &shadow_surface : NULL;
+
+	if (!dirtyfb &&
+	    find_damage_plane(kms_fd, drm_resources, current_crtc_id,
+	                      &damage_plane) == 0)
+		dp = &damage_plane;
+	printf("Submitting damage with %s, drawing %s\n",
+	       dp ? "FB_DAMAGE_CLIPS" : "drmModeDirtyFB",
+	       shadow ? "through a shadow buffer" : "straight into the mapping");
+
+	dumb_damage_reset(&damage);
+	canvas->damage = &damage;
+
+	if (raster) {
+		/* Same as egl-color-kms, without the GPU */
+		dumb_fill(canvas, &whole_screen, 0);
+		dumb_triangle(canvas, triangle);
+		if (present_damage(kms_fd, frame_buffer_id, dp, &surface, shadowed,
+		                   &damage))
+			LOG("Could not flush the damage : %m\n");
+		sleep(seconds);
+		goto scene_done;
+	}
+
+	dumb_gradient(canvas, &whole_screen, 0x000040, 0x4040c0, 1);
+	for (uint_fast32_t c = 0; c < ARRAY_SIZE(colors); c++) {
+		struct dumb_rect const r = {
+			create_request.width / 8 + c * create_request.width / 5,
+			create_request.height / 4,
+			create_request.width / 8,
+			create_request.height / 4
+		};
+
+		dumb_fill(canvas, &r, colors[c]);
+	}
+	struct dumb_rect const veil = {
+		0, create_request.height * 3 / 8,
+		create_request.width, create_request.height / 16
+	};
+	dumb_blend(canvas, &veil, 0x000000, 128);
+	struct dumb_rect const checker = {
+		create_request.width / 8, create_request.height * 5 / 8,
+		create_request.width * 3 / 4, create_request.height / 4
+	};
+	dumb_blit(canvas, &checker, image, create_request.width * 4);
+
+	if (present_damage(kms_fd, frame_buffer_id, dp, &surface, shadowed,
+	                   &damage))
+		LOG("Could not flush the damage : %m\n");
+
+	/* Then bounce a box over the checkerboard. Each update only
+	 * restores the board where the box was and draws it where it is. */
+	int32_t const box_size = checker.h / 2;
+	struct dumb_rect box = { checker.x, checker.y, box_size, box_size };
+	int32_t dx = 7, dy = 3;
+	uint64_t updates = 0, flushed = 0;
+	uint64_t const end = dumb_now_ns() + seconds * 1000000000ull;
+
+	while (dumb_now_ns() < end) {
+		struct dumb_rect const old = box;
+
+		box.x += dx;
+		box.y += dy;
+		if (box.x < checker.x || box.x + box.w > checker.x + checker.w) {
+			dx = -dx;
+			box.x += 2 * dx;
+		}
+		if (box.y < checker.y || box.y + box.h > checker.y + checker.h) {
+			dy = -dy;
+			box.y += 2 * dy;
+		}
+
+		dumb_damage_reset(&damage);
+		dumb_blit(canvas, &old,
+		          image + (old.y - checker.y) * create_request.width +
+		          (old.x - checker.x),
+		          create_request.width * 4);
+		dumb_fill(canvas, &box, colors[(updates / 60) % ARRAY_SIZE(colors)]);
+
+		flushed += dumb_damage_bytes(&damage);
+		if (present_damage(kms_fd, frame_buffer_id, dp, &surface, shadowed,
+		                   &damage)) {
+			LOG("Could not flush the damage : %m\n");
+			break;
+		}
+		updates++;
+
+		/* The atomic commit already waits for the vblank */
+		if (!dp)
+			usleep(16666);
+	}
+
+	if (updates)
+		printf("%llu updates, %.1f KiB flushed per update instead of %.1f KiB\n",
+		       (unsigned long long) updates,
+		       flushed / 1024.0 / updates, screen_bytes / 1024.0);
+
+scene_done:
+	canvas->damage = NULL;
+
+swapchain_done:
+	if (have_shadow)
+		dumb_shadow_fini(&shadow_surface);
+	free(image);
+
+could_not_allocate_image:
+	dumb_draw_fini();
 	munmap(primed_framebuffer, create_request.size);
 
 could_not_map_buffer:
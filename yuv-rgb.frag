@@ -0,0 +1,8 @@
+precision mediump float;
+
+uniform sampler2D tex;
+varying vec2 texcoord;
+
+void main() {
+     gl_FragColor = texture2D(tex, texcoord);
+}